@@ -0,0 +1,351 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+// Measures the host side of the display pipeline stage by stage on common panel sizes.
+// Transfers go to a VirtualIT8951 that doesn't wait, so only host work is timed.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fmt/format.h>
+#include "Dither.hpp"
+#include "EndianConversion.h"
+#include "IT8951.hpp"
+#include "ImageDecode.hpp"
+#include "ImagePipeline.hpp"
+#include "PixelFormat.hpp"
+#include "ScreenManager.hpp"
+#include "VirtualIT8951.hpp"
+#include "log.hpp"
+
+namespace {
+std::atomic<uint64_t> allocations{0};
+
+void* counted_alloc(size_t size, size_t alignment = 0) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  size                = std::max<size_t>(size, 1);
+  void* const pointer = alignment ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                                  : std::malloc(size);
+  if (!pointer) throw std::bad_alloc();
+  return pointer;
+}
+}  // namespace
+
+// Every heap allocation of the process is counted, stages report them per frame
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return counted_alloc(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return counted_alloc(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { std::free(pointer); }
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct PanelSize {
+  uint32_t width;
+  uint32_t height;
+};
+
+constexpr PanelSize panel_sizes[] = {{1872, 1404}, {1200, 825}, {800, 600}};
+
+struct Options {
+  enum class Format { Table, Json, Csv } format = Format::Table;
+  std::chrono::milliseconds min_time{300};
+  size_t                    min_iterations = 5;
+  // Fail when a stage that should be off the heap after warm up allocates
+  bool check_allocations = false;
+  // Fail when multi-threaded error diffusion doesn't match the single-threaded result
+  bool check_dither = false;
+};
+
+struct Result {
+  std::string stage;
+  PanelSize   panel;
+  uint64_t    iterations;
+  // Items are pixels for image stages and calls for per-command stages
+  uint64_t items;
+  double   ns_per_item;
+  double   mb_per_second;
+  double   allocations_per_frame;
+  // Repeating the same sized frame is expected not to allocate at all
+  bool steady_state = false;
+};
+
+/**
+ * Runs frame until both the minimum time and iteration count are reached and reports
+ * the median frame.
+ * @param bytes what a frame produces, for MB/s
+ * @param settle runs untimed after every frame
+ */
+template <typename Frame, typename Settle = void (*)()>
+Result measure(const Options& options, std::string stage, PanelSize panel, uint64_t items, uint64_t bytes,
+               Frame&& frame, Settle&& settle = [] {}) {
+  frame();  // Warm up caches and lazily built tables
+  std::vector<double> times;
+  uint64_t            allocated = 0;
+  const auto          start     = Clock::now();
+  while (times.size() < options.min_iterations || Clock::now() - start < options.min_time) {
+    const auto allocations_before = allocations.load(std::memory_order_relaxed);
+    const auto frame_start        = Clock::now();
+    frame();
+    times.push_back(std::chrono::duration<double, std::nano>(Clock::now() - frame_start).count());
+    allocated += allocations.load(std::memory_order_relaxed) - allocations_before;
+    settle();
+  }
+  std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+  const auto median = times[times.size() / 2];
+  return {.stage                 = std::move(stage),
+          .panel                 = panel,
+          .iterations            = times.size(),
+          .items                 = items,
+          .ns_per_item           = median / static_cast<double>(items),
+          .mb_per_second         = static_cast<double>(bytes) * 1e3 / median,
+          .allocations_per_frame = static_cast<double>(allocated) / static_cast<double>(times.size())};
+}
+
+// A photo-like gradient with some texture, larger than the panel and in the other orientation
+cv::Mat make_source(PanelSize panel) {
+  cv::Mat source(static_cast<int>(panel.width * 5 / 4), static_cast<int>(panel.height * 5 / 4), CV_8UC1);
+  for (int y = 0; y < source.rows; y++) {
+    auto* row = source.ptr<uint8_t>(y);
+    for (int x = 0; x < source.cols; x++) row[x] = static_cast<uint8_t>((x + y) * 255 / (source.cols + source.rows) ^ (x * y & 7));
+  }
+  return source;
+}
+
+// Error diffusion over several threads has to give the very same bytes as over one
+bool dither_threads_match(const std::vector<uint8_t>& frame, PanelSize panel) {
+  const cv::Mat source(static_cast<int>(panel.height), static_cast<int>(panel.width), CV_8UC1,
+                       const_cast<uint8_t*>(frame.data()));
+  bool          match = true;
+  for (const auto mode : {DitherMode::FloydSteinberg, DitherMode::Atkinson}) {
+    cv::Mat single = source.clone();
+    dither(single, PixelFormat::Bpp4, mode, 1);
+    // Races only show up now and then, so give them a few chances
+    for (int run = 0; run < 8; run++) {
+      cv::Mat threaded = source.clone();
+      dither(threaded, PixelFormat::Bpp4, mode, 4);
+      if (std::memcmp(threaded.data, single.data, frame.size()) == 0) continue;
+      fmt::print(stderr, "Threaded {} dithering on {}x{} differs from single-threaded\n",
+                 mode == DitherMode::Atkinson ? "Atkinson" : "Floyd-Steinberg", panel.width, panel.height);
+      match = false;
+      break;
+    }
+  }
+  return match;
+}
+
+bool run_panel(const Options& options, PanelSize panel, std::vector<Result>& results) {
+  const auto pixels = static_cast<uint64_t>(panel.width) * panel.height;
+  const auto source = make_source(panel);
+  const auto levels = quantization_table(PixelFormat::Bpp4);
+  const int  rotation = cv::ROTATE_90_CLOCKWISE;
+
+  std::vector<uint8_t> encoded;
+  cv::imencode(".png", source, encoded);
+  results.push_back(measure(options, "decode_png", panel, static_cast<uint64_t>(source.total()), source.total(),
+                            [&] { cv::imdecode(encoded, cv::IMREAD_GRAYSCALE); }));
+
+  // A 24 MP camera photo decoded in full and reduced to what the panel needs, the render after it
+  // shows what the smaller source saves downstream
+  const auto           photo = make_source({4800, 3200});
+  std::vector<uint8_t> jpeg;
+  cv::imencode(".jpg", photo, jpeg);
+  const auto photo_header = read_image_header(jpeg);
+  const auto factor       = photo_header ? reduced_decode_factor(*photo_header, rotation, panel.width, panel.height) : 1;
+  cv::Mat    full, reduced;
+  results.push_back(measure(options, "decode_jpeg_24mp_full", panel, photo.total(), photo.total(),
+                            [&] { full = cv::imdecode(jpeg, cv::IMREAD_GRAYSCALE); }));
+  results.push_back(measure(options, fmt::format("decode_jpeg_24mp_reduced_{}", factor), panel, photo.total(),
+                            photo.total() / (factor * factor),
+                            [&] { reduced = decode_for_panel(jpeg, rotation, panel.width, panel.height); }));
+
+  // What ScreenManager::display did before the fused pipeline
+  std::vector<uint8_t> quantized(pixels);
+  results.push_back(measure(options, "rotate_resize_quantize_separate", panel, pixels, pixels, [&] {
+    cv::Mat rotated, resized;
+    cv::rotate(source, rotated, rotation);
+    cv::resize(rotated, resized, cv::Size(static_cast<int>(panel.width), static_cast<int>(panel.height)));
+    quantize_pixels(std::span(resized.data, resized.total()), resized.step[0], panel.width, panel.height,
+                    PixelFormat::Bpp4, quantized);
+  }));
+
+  std::vector<uint8_t> frame(pixels);
+  results.push_back(measure(options, "render_to_panel_fused", panel, pixels, pixels,
+                            [&] { render_to_panel(source, rotation, panel.width, panel.height, levels, frame); }));
+  results.push_back(measure(options, "render_jpeg_24mp_full", panel, pixels, pixels,
+                            [&] { render_to_panel(full, rotation, panel.width, panel.height, levels, frame); }));
+  results.push_back(measure(options, fmt::format("render_jpeg_24mp_reduced_{}", factor), panel, pixels, pixels,
+                            [&] { render_to_panel(reduced, rotation, panel.width, panel.height, levels, frame); }));
+
+  const auto identity = quantization_table(PixelFormat::Bpp8);
+  render_to_panel(source, rotation, panel.width, panel.height, identity, frame);
+  std::vector<uint8_t> scratch(pixels);
+  cv::Mat              scratch_mat(static_cast<int>(panel.height), static_cast<int>(panel.width), CV_8UC1,
+                                   scratch.data());
+  for (const auto& [name, mode, format] :
+       {std::tuple{"dither_bayer_1bpp", DitherMode::Bayer, PixelFormat::Bpp1},
+        std::tuple{"dither_blue_noise_1bpp", DitherMode::BlueNoise, PixelFormat::Bpp1},
+        std::tuple{"dither_floyd_steinberg_4bpp", DitherMode::FloydSteinberg, PixelFormat::Bpp4},
+        std::tuple{"dither_atkinson_4bpp", DitherMode::Atkinson, PixelFormat::Bpp4}}) {
+    results.push_back(measure(options, name, panel, pixels, pixels, [&] {
+      std::memcpy(scratch.data(), frame.data(), pixels);
+      dither(scratch_mat, format, mode);
+    }));
+  }
+
+  const bool dither_ok = !options.check_dither || dither_threads_match(frame, panel);
+
+  std::vector<uint8_t> packed(packed_row_bytes(panel.width, PixelFormat::Bpp1) * panel.height);
+  results.push_back(measure(options, "pack_1bpp", panel, pixels, packed.size(), [&] {
+    pack_pixels(frame, panel.width, panel.width, panel.height, PixelFormat::Bpp1, packed);
+  }));
+
+  // One header per load chunk and display command, swapped on every call
+  constexpr uint64_t swaps = 1000;
+  IT8951DisplayArea  header{
+       .address = 0x119F00, .wavemode = WaveMode::GC16, .area = {0, 0, panel.width, panel.height}, .wait_ready = 0};
+  volatile uint32_t sink = 0;
+  results.push_back(measure(options, "host_to_be_uint32t_members", panel, swaps, swaps * sizeof(header), [&] {
+    for (uint64_t i = 0; i < swaps; i++) {
+      header.area.y = static_cast<uint32_t>(i);
+      sink          = sink + host_to_be_uint32t_members(header).area.y;
+    }
+  }));
+
+  // Chunk planning and buffer assembly, the virtual device copies the data once itself
+  const auto path = fmt::format("bench-{}x{}", panel.width, panel.height);
+  VirtualIT8951::register_device(
+      path, std::make_shared<VirtualIT8951>(VirtualDeviceConfig{.width = panel.width, .height = panel.height, .time_scale = 0}));
+  {
+    IT8951     it{ScsiDriver(path.c_str())};
+    const auto info = it.get_system_info();
+    // Both upload engines, fast write memory streams the frame without load image headers
+    for (const auto& [engine, name] : {std::pair{UploadEngine::LoadImageArea, "load_image_area"},
+                                       std::pair{UploadEngine::FastWriteMemory, "fast_write_memory"}}) {
+      it.set_upload_engine(engine);
+      for (const size_t in_flight : {1, 4}) {
+        it.set_max_in_flight(in_flight);
+        results.push_back(measure(options, fmt::format("{}_in_flight_{}", name, in_flight), panel, pixels, pixels, [&] {
+          it.load_image_area({.address = info->uiImageBufBase, .area = {0, 0, panel.width, panel.height}}, frame,
+                             panel.width);
+        }));
+      }
+    }
+  }
+
+  // Everything from a decoded image to the display command, alternating frames so every one is uploaded.
+  // The readiness tracker still predicts real waveform times, waiting for them isn't host work.
+  {
+    ScreenManager screen{IT8951(ScsiDriver(path.c_str()))};
+    cv::Mat       inverted = source.clone();
+    for (size_t i = 0; i < inverted.total(); i++) inverted.data[i] = static_cast<uint8_t>(~inverted.data[i]);
+    screen.set_rotation(rotation);
+    bool flip = false;
+    results.push_back(measure(
+        options, "screen_manager_display", panel, pixels, pixels,
+        [&] { screen.display((flip = !flip) ? source : inverted); }, [&] { screen.wait_until_ready(); }));
+    results.back().steady_state = true;
+    // Threshold dithered and packed to 1bpp, the A2 path
+    screen.set_pixel_format(PixelFormat::Bpp1);
+    screen.set_dither_mode(DitherMode::Bayer);
+    results.push_back(measure(
+        options, "screen_manager_display_1bpp_bayer", panel, pixels, pixels / 8,
+        [&] { screen.display((flip = !flip) ? source : inverted); }, [&] { screen.wait_until_ready(); }));
+    results.back().steady_state = true;
+    // Error diffused for GC16, rows run on the screen's worker threads
+    screen.set_pixel_format(PixelFormat::Bpp4);
+    screen.set_dither_mode(DitherMode::FloydSteinberg);
+    results.push_back(measure(
+        options, "screen_manager_display_4bpp_floyd_steinberg", panel, pixels, pixels,
+        [&] { screen.display((flip = !flip) ? source : inverted); }, [&] { screen.wait_until_ready(); }));
+    results.back().steady_state = true;
+  }
+  VirtualIT8951::unregister_device(path);
+  return dither_ok;
+}
+
+void print(const Options& options, const std::vector<Result>& results) {
+  switch (options.format) {
+    case Options::Format::Table:
+      fmt::print("{:<36} {:>10} {:>12} {:>10} {:>10} {:>8}\n", "stage", "panel", "ns/item", "MB/s", "allocs", "runs");
+      for (const auto& result : results) {
+        fmt::print("{:<36} {:>10} {:>12.3f} {:>10.1f} {:>10.1f} {:>8}\n", result.stage,
+                   fmt::format("{}x{}", result.panel.width, result.panel.height), result.ns_per_item,
+                   result.mb_per_second, result.allocations_per_frame, result.iterations);
+      }
+      break;
+    case Options::Format::Csv:
+      fmt::print("stage,width,height,items,ns_per_item,mb_per_second,allocations_per_frame,iterations\n");
+      for (const auto& result : results) {
+        fmt::print("{},{},{},{},{:.4f},{:.2f},{:.2f},{}\n", result.stage, result.panel.width, result.panel.height,
+                   result.items, result.ns_per_item, result.mb_per_second, result.allocations_per_frame,
+                   result.iterations);
+      }
+      break;
+    case Options::Format::Json:
+      fmt::print("[\n");
+      for (size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        fmt::print(
+            "  {{\"stage\": \"{}\", \"width\": {}, \"height\": {}, \"items\": {}, \"ns_per_item\": {:.4f}, "
+            "\"mb_per_second\": {:.2f}, \"allocations_per_frame\": {:.2f}, \"iterations\": {}}}{}\n",
+            result.stage, result.panel.width, result.panel.height, result.items, result.ns_per_item,
+            result.mb_per_second, result.allocations_per_frame, result.iterations, i + 1 < results.size() ? "," : "");
+      }
+      fmt::print("]\n");
+      break;
+  }
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view argument = argv[i];
+    if (argument == "--json") {
+      options.format = Options::Format::Json;
+    } else if (argument == "--csv") {
+      options.format = Options::Format::Csv;
+    } else if (argument == "--check-allocations") {
+      options.check_allocations = true;
+    } else if (argument == "--check-dither") {
+      options.check_dither = true;
+    } else if (argument.starts_with("--min-time-ms=")) {
+      options.min_time = std::chrono::milliseconds(std::atoi(argv[i] + argument.find('=') + 1));
+    } else {
+      fmt::print(stderr, "Usage: {} [--json|--csv] [--min-time-ms=N] [--check-allocations] [--check-dither]\n", argv[0]);
+      return 1;
+    }
+  }
+  // Debug logging would end up in the measurements
+  maxLogLevel = LogLevel::Warning;
+
+  std::vector<Result> results;
+  bool failed = false;
+  for (const auto panel : panel_sizes) failed |= !run_panel(options, panel, results);
+  print(options, results);
+  if (!options.check_allocations) return failed ? 1 : 0;
+  for (const auto& result : results) {
+    if (!result.steady_state || result.allocations_per_frame == 0) continue;
+    fmt::print(stderr, "{} on {}x{} allocates {:.1f} times per frame\n", result.stage, result.panel.width,
+               result.panel.height, result.allocations_per_frame);
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}
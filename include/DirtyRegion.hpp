@@ -0,0 +1,42 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <cstdint>
+#include <memory_resource>
+#include <opencv2/core.hpp>
+#include <vector>
+#include "IT8951.hpp"
+
+struct DisplayStats {
+  uint64_t bytes_sent    = 0;  // Pixel bytes uploaded to the controller
+  uint64_t bytes_skipped = 0;  // Pixel bytes that were already on the panel
+  uint64_t area_updated  = 0;  // Pixels refreshed
+  uint64_t area_skipped  = 0;  // Pixels left untouched
+  uint32_t regions       = 0;  // Number of load/display rounds issued
+
+  DisplayStats& operator+=(const DisplayStats& other) {
+    bytes_sent += other.bytes_sent;
+    bytes_skipped += other.bytes_skipped;
+    area_updated += other.area_updated;
+    area_skipped += other.area_skipped;
+    regions += other.regions;
+    return *this;
+  }
+};
+
+/**
+ * Compares two equally sized 8bpp frames tile by tile and merges the tiles that
+ * differ into rectangles. Rows of a tile are compared with memcmp, which is
+ * vectorized by the C library and bails out on the first difference.
+ * @param previous what the panel currently shows
+ * @param next what it should show
+ * @param tile_size edge length of a tile in pixels
+ * @param max_regions if more rectangles than this are found their bounding box is returned
+ * @param memory where the result and the per tile bookkeeping are allocated
+ * @return changed areas relative to the frames' origin, empty if nothing changed
+ */
+std::pmr::vector<IT8951Area> find_dirty_areas(const cv::Mat& previous, const cv::Mat& next,
+                                              uint32_t tile_size = 32, size_t max_regions = 16,
+                                              std::pmr::memory_resource* memory = std::pmr::get_default_resource());
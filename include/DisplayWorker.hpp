@@ -0,0 +1,84 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ScreenManager.hpp"
+
+// What submit does when the queue is full
+enum class QueueFullPolicy : uint8_t {
+  // Refuse the job like Reject does, the caller holds on to a bounded number of jobs and
+  // submits them again as completions free up room
+  Wait,
+  // Cancel the oldest queued job, for callers where only the latest frame matters
+  ReplaceOldest,
+  // Refuse the job, the caller reports it as failed
+  Reject,
+};
+
+struct DisplayJobResult {
+  enum class Status : uint8_t { Done, Cancelled, Failed };
+
+  uint64_t     id     = 0;
+  Status       status = Status::Done;
+  DisplayStats stats{};
+  std::string  error{};
+};
+
+/**
+ * Owns a ScreenManager and runs display jobs on it from a single worker thread, so
+ * callers never block on a transfer or refresh. Finished jobs are collected in a
+ * completion queue, notify is called from the worker whenever one is added.
+ */
+class DisplayWorker {
+ public:
+  using Job = std::function<DisplayStats(ScreenManager&)>;
+
+  DisplayWorker(ScreenManager&& screen, size_t capacity = 2, QueueFullPolicy policy = QueueFullPolicy::Wait,
+                std::function<void()> notify = {});
+  DisplayWorker(const DisplayWorker&)            = delete;
+  DisplayWorker& operator=(const DisplayWorker&) = delete;
+  // Cancels queued jobs and waits for the running one
+  ~DisplayWorker();
+
+  // nullopt when the queue is full and the policy doesn't make room
+  std::optional<uint64_t> submit(Job job);
+  // Only queued jobs can be cancelled, a running job always finishes
+  bool cancel(uint64_t id);
+
+  std::vector<DisplayJobResult> take_completions();
+
+  [[nodiscard]] size_t          queued() const;
+  [[nodiscard]] size_t          get_capacity() const { return capacity; }
+  [[nodiscard]] QueueFullPolicy get_policy() const { return policy; }
+
+ private:
+  struct QueuedJob {
+    uint64_t id;
+    Job      job;
+  };
+
+  ScreenManager                 screen;
+  const size_t                  capacity;
+  const QueueFullPolicy         policy;
+  const std::function<void()>   notify;
+  mutable std::mutex            mutex;
+  std::condition_variable       jobs_changed;
+  std::deque<QueuedJob>         jobs;
+  std::vector<DisplayJobResult> completions;
+  uint64_t                      next_id  = 1;
+  bool                          stopping = false;
+  std::thread                   worker;
+
+  void complete(DisplayJobResult result);
+  void run_worker();
+};
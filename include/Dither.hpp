@@ -0,0 +1,35 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <cstdint>
+#include <memory_resource>
+#include <opencv2/core.hpp>
+#include "PixelFormat.hpp"
+#include "WorkerPool.hpp"
+
+enum class DitherMode : uint8_t {
+  None,
+  // Threshold maps, cheap enough to run in front of every A2 update
+  Bayer,
+  BlueNoise,
+  // Error diffusion for GC16 quality, rows run in parallel as a wavefront
+  FloydSteinberg,
+  Atkinson,
+};
+
+/**
+ * Dithers an 8bpp image in place to the gray levels of format, levels are spread over
+ * 0-255 like quantize_pixels does so the result can be loaded with any format.
+ * Throughput targets on a single core of a Raspberry Pi 4 class machine: threshold
+ * maps 500 Mpixel/s, error diffusion 50 Mpixel/s per thread, both well above what a
+ * USB 2.0 load-image transfer can take.
+ * @param threads worker threads for error diffusion, 0 picks the hardware concurrency or
+ *                all of pool
+ * @param memory where error diffusion keeps its error rows
+ * @param pool runs error diffusion on threads that already exist, without it they're
+ *             started for every call
+ */
+void dither(cv::Mat& img, PixelFormat format, DitherMode mode, unsigned threads = 0,
+            std::pmr::memory_resource* memory = std::pmr::get_default_resource(), WorkerPool* pool = nullptr);
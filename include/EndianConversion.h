@@ -34,3 +34,37 @@
 #error platform not supported
 
 #endif
+
+#include <cstdint>
+
+/**
+ * @warning ONLY USE THIS ON TYPES OF WHICH ALL MEMBERS ARE UINT32_T
+ * @tparam T Struct of which all members are uint32_t and need to be swapped
+ * @param t original value
+ * @return new swapped value;
+ */
+template<typename T>
+T host_to_be_uint32t_members(const T &t) {
+    auto copy = t;
+    auto copyptr = reinterpret_cast<uint32_t *>(&copy);
+    for (int i = 0; i < sizeof(T) / sizeof(uint32_t); i++) {
+        copyptr[i] = htobe32(copyptr[i]);
+    }
+    return copy;
+}
+
+/**
+ * @warning ONLY USE THIS ON TYPES OF WHICH ALL MEMBERS ARE UINT32_T
+ * @tparam T Struct of which all members are uint32_t and need to be swapped
+ * @param t original value
+ * @return new swapped value;
+ */
+template<typename T>
+T be_to_host_uint32t_members(const T &t) {
+    auto copy = t;
+    auto copyptr = reinterpret_cast<uint32_t *>(&copy);
+    for (int i = 0; i < sizeof(T) / sizeof(uint32_t); i++) {
+        copyptr[i] = be32toh(copyptr[i]);
+    }
+    return copy;
+}
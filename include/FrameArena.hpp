@@ -0,0 +1,69 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+/**
+ * Scratch memory for displaying one frame: resampling tables, dirty area lists, packed
+ * and quantized pixels. Everything comes from one preallocated buffer and is dropped at
+ * once when the outermost Scope ends, so a display doesn't touch the heap. When a frame
+ * needs more than the buffer holds the rest comes from the heap, and the buffer grows by
+ * that much afterwards so the same frame fits next time. Not thread safe.
+ */
+class FrameArena {
+ public:
+  // Keeps memory handed out until the outermost scope of the arena ends
+  class [[nodiscard]] Scope {
+   public:
+    explicit Scope(FrameArena& arena) : arena(arena) { arena.depth++; }
+    Scope(const Scope&)            = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() { arena.leave(); }
+
+   private:
+    FrameArena& arena;
+  };
+
+  // What a frame on a width x height panel needs at most, error diffusion and 1bpp packing included
+  static size_t bytes_for_panel(uint32_t width, uint32_t height);
+
+  explicit FrameArena(size_t bytes);
+  FrameArena(const FrameArena&)            = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  [[nodiscard]] std::pmr::memory_resource* resource() { return &*monotonic; }
+  [[nodiscard]] Scope                      scope() { return Scope(*this); }
+
+  [[nodiscard]] size_t capacity() const { return size; }
+  // Times a frame didn't fit and the buffer had to grow
+  [[nodiscard]] uint64_t growths() const { return grown; }
+
+ private:
+  // Heap memory the monotonic resource takes once the buffer is used up, counted to size the next buffer
+  class Overflow : public std::pmr::memory_resource {
+   public:
+    size_t bytes = 0;
+
+   private:
+    void* do_allocate(size_t count, size_t alignment) override;
+    void  do_deallocate(void* pointer, size_t count, size_t alignment) override;
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+      return this == &other;
+    }
+  };
+
+  size_t                                             size;
+  std::unique_ptr<std::byte[]>                       buffer;
+  Overflow                                           overflow;
+  std::optional<std::pmr::monotonic_buffer_resource> monotonic;
+  uint32_t                                           depth = 0;
+  uint64_t                                           grown = 0;
+
+  void leave();
+};
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Identifies a source file revision rendered for one rotation and panel size
+struct FrameKey {
+  std::string path;
+  int64_t     modified;
+  uintmax_t   size;
+  int         rotation;
+  uint32_t    width;
+  uint32_t    height;
+
+  bool operator==(const FrameKey&) const = default;
+
+  // Stats the file, nullopt when it can't be read
+  static std::optional<FrameKey> for_file(const std::filesystem::path& path, int rotation, uint32_t width,
+                                          uint32_t height);
+};
+
+struct FrameCacheStats {
+  uint64_t hits      = 0;
+  uint64_t misses    = 0;
+  uint64_t evictions = 0;
+  size_t   bytes     = 0;
+  size_t   entries   = 0;
+};
+
+/**
+ * Least recently used cache of panel-ready frames, so images that are shown again
+ * skip decoding, rotating, scaling and quantizing. Frames are shared, an evicted frame
+ * stays valid for whoever is still using it.
+ */
+class FrameCache {
+ public:
+  using Frame = std::shared_ptr<const std::vector<uint8_t>>;
+
+  explicit FrameCache(size_t max_bytes = 64 * 1024 * 1024) : max_bytes(max_bytes) {}
+
+  // Counts a hit or miss and marks the frame as most recently used
+  Frame find(const FrameKey& key);
+  // Evicts the least recently used frames until the new one fits, frames larger than the cap aren't kept
+  Frame insert(const FrameKey& key, std::vector<uint8_t> frame);
+
+  // Drops every frame rendered from path
+  void invalidate(const std::filesystem::path& path);
+  void clear();
+
+  // 0 disables the cache
+  void   set_max_bytes(size_t bytes);
+  size_t get_max_bytes() const { return max_bytes; }
+
+  [[nodiscard]] FrameCacheStats stats() const;
+
+ private:
+  struct KeyHash {
+    size_t operator()(const FrameKey& key) const;
+  };
+  using Entry = std::pair<FrameKey, Frame>;
+
+  void evict_until(size_t bytes);
+
+  size_t max_bytes;
+  size_t bytes = 0;
+  // Most recently used first
+  std::list<Entry>                                                  entries;
+  std::unordered_map<FrameKey, std::list<Entry>::iterator, KeyHash> index;
+  uint64_t                                                          hits      = 0;
+  uint64_t                                                          misses    = 0;
+  uint64_t                                                          evictions = 0;
+};
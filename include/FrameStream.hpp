@@ -0,0 +1,177 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <opencv2/videoio.hpp>
+#include "ScreenManager.hpp"
+
+/**
+ * Hands frames from one pipeline stage to the next without locks. It's a triple buffer:
+ * the producer fills its own slot and swaps it with the middle one, the consumer swaps
+ * the middle slot for its own when it holds something new. So it never holds more than
+ * one waiting frame and a frame that wasn't taken yet is replaced by the newer one.
+ * Exactly one producer and one consumer thread.
+ */
+template <typename T>
+class FrameExchange {
+  // Middle slot index in bits 0-1, bit 2 while it holds a frame that wasn't taken, bit 3 once closed
+  static constexpr uint32_t index_mask = 3;
+  static constexpr uint32_t fresh      = 4;
+  static constexpr uint32_t closed     = 8;
+
+  std::array<T, 3>      slots{};
+  std::atomic<uint32_t> middle{1};
+  uint32_t              back  = 0;  // Owned by the producer
+  uint32_t              front = 2;  // Owned by the consumer
+
+ public:
+  // The slot the producer fills next
+  T& writable() { return slots[back]; }
+
+  // Passes the filled slot on, false when it replaced a frame the consumer never took
+  bool publish() {
+    auto previous = middle.load(std::memory_order_relaxed);
+    while (!middle.compare_exchange_weak(previous, back | fresh | (previous & closed), std::memory_order_acq_rel)) {}
+    back = previous & index_mask;
+    middle.notify_all();
+    return !(previous & fresh);
+  }
+
+  // Waits until the consumer took the last published frame, for streams that mustn't drop any
+  void wait_until_taken() const {
+    for (auto current = middle.load(std::memory_order_acquire); (current & fresh) && !(current & closed);
+         current      = middle.load(std::memory_order_acquire)) {
+      middle.wait(current, std::memory_order_acquire);
+    }
+  }
+
+  // Waits for the newest frame, nullptr once closed and everything published was taken
+  T* take() {
+    auto current = middle.load(std::memory_order_acquire);
+    while (!(current & fresh)) {
+      if (current & closed) return nullptr;
+      middle.wait(current, std::memory_order_acquire);
+      current = middle.load(std::memory_order_acquire);
+    }
+    while (!middle.compare_exchange_weak(current, front | (current & closed), std::memory_order_acq_rel)) {}
+    front = current & index_mask;
+    middle.notify_all();
+    return &slots[front];
+  }
+
+  // Wakes both sides for good, a frame still waiting can be taken
+  void close() {
+    middle.fetch_or(closed, std::memory_order_acq_rel);
+    middle.notify_all();
+  }
+};
+
+struct StreamOptions {
+  WaveMode    wavemode = WaveMode::A2;
+  PixelFormat format   = PixelFormat::Bpp1;
+  DitherMode  dither   = DitherMode::Bayer;
+  // Video files are decoded no faster than their frame rate, callbacks pace themselves
+  bool realtime = true;
+  // When a stage falls behind the frame it hasn't started on is replaced by the newest,
+  // otherwise the stages in front of it wait and every frame is shown
+  bool latest_frame_wins = true;
+};
+
+enum class StreamStage : uint8_t { Decode, Render, Dither, Upload };
+constexpr size_t stream_stage_count = 4;
+
+struct StreamStageStats {
+  uint64_t frames  = 0;  // Frames the stage finished
+  uint64_t dropped = 0;  // Frames it passed on that were replaced before the next stage took them
+  // Share of the running time the stage was working instead of waiting for a frame or the panel
+  double occupancy = 0;
+};
+
+struct StreamStats {
+  uint64_t                 frames_shown = 0;
+  double                   fps          = 0;
+  std::chrono::nanoseconds elapsed{0};
+  // From the source delivering a frame until its display command was sent
+  std::chrono::nanoseconds mean_latency{0};
+  std::chrono::nanoseconds max_latency{0};
+  std::array<StreamStageStats, stream_stage_count> stages{};
+
+  const StreamStageStats& operator[](StreamStage stage) const { return stages[static_cast<size_t>(stage)]; }
+};
+
+/**
+ * Plays a video or a sequence of generated frames on a panel with every stage on its own
+ * thread: decoding, rotating and scaling, dithering and finally uploading and refreshing,
+ * connected by FrameExchanges. While the panel runs the waveform for one frame the next
+ * one is already being prepared, and the upload stage only picks a frame up right before
+ * the panel is predicted to be ready, so what it shows is never older than necessary.
+ * Packing to 1bpp happens in the upload, where dirty areas are found on the 8 bit frame.
+ */
+class FrameStream {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Fills frame with the next 8bpp gray or BGR(A) image, false when there are no more
+  using FrameSource = std::function<bool(cv::Mat& frame)>;
+
+  FrameStream(ScreenManager&& screen, const std::filesystem::path& video, StreamOptions options = {});
+  FrameStream(ScreenManager&& screen, FrameSource source, StreamOptions options = {});
+  FrameStream(const FrameStream&)            = delete;
+  FrameStream& operator=(const FrameStream&) = delete;
+  // Stops and waits for the stages
+  ~FrameStream();
+
+  // Ends the stream after the frames the stages are working on
+  void stop();
+  // Waits until the source ran out or the stream was stopped, from one thread at a time
+  void wait();
+  [[nodiscard]] bool running() const { return !finished.load(std::memory_order_acquire); }
+
+  [[nodiscard]] StreamStats stats() const;
+
+ private:
+  struct Frame {
+    cv::Mat           image;
+    Clock::time_point captured;
+  };
+
+  struct StageCounters {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<int64_t>  busy_ns{0};
+  };
+
+  ScreenManager         screen;
+  const StreamOptions   options;
+  FrameSource           source;
+  // Time between source frames when decoding is paced, zero runs as fast as the source delivers
+  Clock::duration       frame_period{0};
+  FrameExchange<Frame>  decoded;
+  FrameExchange<Frame>  rendered;
+  FrameExchange<Frame>  dithered;
+  std::atomic<bool>     stopping{false};
+  std::atomic<bool>     finished{false};
+  const Clock::time_point start = Clock::now();
+  std::atomic<int64_t>  end_ns{0};
+  std::atomic<uint64_t> frames_shown{0};
+  std::atomic<int64_t>  total_latency_ns{0};
+  std::atomic<int64_t>  max_latency_ns{0};
+  std::array<StageCounters, stream_stage_count> counters;
+  std::array<std::thread, stream_stage_count>   threads;
+
+  void start_stages();
+  // Passes a finished frame on and counts it, waiting for the next stage unless frames may be dropped
+  void hand_over(StreamStage stage, FrameExchange<Frame>& exchange, Clock::time_point started);
+  void run_decode();
+  void run_render();
+  void run_dither();
+  void run_upload();
+};
@@ -3,8 +3,12 @@
  * SPDX-License-Identifier: Apache-2.0
 */
 #pragma once
+#include <filesystem>
 #include <memory>
+#include <memory_resource>
 #include <vector>
+#include "PixelFormat.hpp"
+#include "ReadinessTracker.hpp"
 #include "ScsiDriver.hpp"
 
 struct IT8951SystemInfo {
@@ -46,6 +50,12 @@ enum class WaveMode : uint32_t {
   DU4   = 6,
   A2    = 7
 };
+// How load_image_area gets pixels into the controller's image buffer
+enum class UploadEngine {
+  LoadImageArea,    // 0xA2, every chunk carries an IT8951ImgLoadArea header and whole rows
+  FastWriteMemory,  // 0xA5, full width rows are streamed as raw bytes to their buffer address
+};
+
 struct IT8951DisplayArea {
   uint32_t   address;
   WaveMode   wavemode;
@@ -56,15 +66,40 @@ struct IT8951DisplayArea {
 class IT8951 {
   ScsiDriver                      driver;
   std::optional<IT8951SystemInfo> cached_system_info;
+  bool                            one_bpp_mode = false;
+  size_t                          transfer_size;
+  size_t                          max_in_flight = 1;
+  UploadEngine                    upload_engine = UploadEngine::LoadImageArea;
+  std::unique_ptr<ReadinessTracker> readiness;
+
+  bool load_image_chunk(const IT8951ImgLoadArea& area, std::span<const uint8_t> pixelData,
+                        size_t stride) const;
+  bool load_image_chunks_pipelined(const IT8951ImgLoadArea& area, std::span<const uint8_t> pixelData,
+                                   size_t stride, uint32_t lines) const;
+  // Collects the completions a failed pipelined transfer left queued, so the next transfer doesn't take them for its own.
+  // Requests that don't finish in time are abandoned.
+  void drain_in_flight() const;
+  // Sends data to consecutive addresses with the given memory write command, split at the length limit
+  bool write_memory_chunks(uint8_t command, uint32_t address, std::span<const uint8_t> data) const;
+
+  [[nodiscard]] std::optional<uint32_t> read_status() const;
 
  public:
-  explicit IT8951(ScsiDriver&& driver) : driver(std::forward<ScsiDriver>(driver)){};
-  IT8951(IT8951&& other) noexcept : driver(std::move(other.driver)) {
+  explicit IT8951(ScsiDriver&& driver)
+      : driver(std::forward<ScsiDriver>(driver)),
+        transfer_size(std::min<size_t>(SPT_BUF_SIZE, this->driver.max_transfer_size())),
+        readiness(std::make_unique<ReadinessTracker>([this] { return read_status(); })){};
+  IT8951(IT8951&& other) noexcept
+      : driver(std::move(other.driver)), one_bpp_mode(other.one_bpp_mode), transfer_size(other.transfer_size),
+        max_in_flight(other.max_in_flight), upload_engine(other.upload_engine), readiness(std::move(other.readiness)) {
     log(LogLevel::Debug, "moved it8951");
     std::swap(this->cached_system_info, other.cached_system_info);
+    readiness->set_reader([this] { return read_status(); });
   }
 
   [[nodiscard]] bool is_it8951() const;
+  // Whether inquiry data, e.g. from ScsiDriver::inquiry, names an IT8951
+  [[nodiscard]] static bool identifies_as_it8951(std::span<const uint8_t> inquiry_data);
 
   std::optional<IT8951SystemInfo> get_system_info();
 
@@ -74,10 +109,89 @@ class IT8951 {
 
   [[nodiscard]] bool write_register(uint32_t address, uint32_t value) const;
 
-  void wait_until_ready() const;
+  /**
+   * Raw controller memory through the read/write memory commands (0x81/0x82). Registers
+   * are memory mapped too, so a block of them moves in one round trip as long as it fits
+   * a single command, larger blocks are split at the 64KB command length limit.
+   */
+  [[nodiscard]] bool read_memory(uint32_t address, std::span<uint8_t> data) const;
+  [[nodiscard]] bool write_memory(uint32_t address, std::span<const uint8_t> data) const;
+  // Consecutive 32 bit registers from address on, in memory they're little endian
+  [[nodiscard]] bool read_registers(uint32_t address, std::span<uint32_t> values) const;
+  [[nodiscard]] bool write_registers(uint32_t address, std::span<const uint32_t> values) const;
+
+  /**
+   * Sleeps until shortly before the running refreshes are predicted to end and then polls
+   * the LUT engine status with backoff.
+   * @return false on timeout or when the status can't be read
+   */
+  bool wait_until_ready() const;
+  // Same wait on a background thread, callback is called from that thread
+  std::future<bool> when_ready(std::function<void(bool)> callback = {}) const;
+  [[nodiscard]] ReadinessTracker::Clock::time_point predicted_ready() const;
+
+  void load_image_area(const IT8951ImgLoadArea& area, std::span<const uint8_t> pixelData) const;
+  void load_image_area(const IT8951Area& area, std::span<const uint8_t> pixelData);
+  // Rows of pixelData are stride bytes apart, e.g. a sub-rectangle of a larger image
+  bool load_image_area(const IT8951ImgLoadArea& area, std::span<const uint8_t> pixelData,
+                       size_t stride) const;
+  /**
+   * Quantizes and uploads 8bpp pixels in the given format. The USB load command only
+   * carries bytes, so 1bpp is sent packed and displayed in the controller's 1bpp mode
+   * while 2bpp and 4bpp are quantized to their gray levels but still sent as 8bpp.
+   * 1bpp areas that are not 32 pixel aligned fall back to thresholded 8bpp.
+   * @param memory where the packed or quantized copy lives until it's sent
+   * @return false when the transfer failed
+   */
+  bool load_image_area(const IT8951ImgLoadArea& area, std::span<const uint8_t> pixelData,
+                       size_t stride, PixelFormat format, const ToneMap* tone_map = nullptr,
+                       std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+  /**
+   * Uploads pixels that are already in transfer layout, rows of packed_row_bytes for 1bpp
+   * and one quantized byte per pixel for the other formats, e.g. a PanelImage. 1bpp areas
+   * must be 32 pixel aligned.
+   * @return false when the transfer failed
+   */
+  bool load_prepared_image_area(const IT8951ImgLoadArea& area, std::span<const uint8_t> data,
+                                PixelFormat format);
+  // Whether load_image_area with format sends area packed and in the controller's 1bpp mode
+  [[nodiscard]] static bool loads_packed(const IT8951Area& area, PixelFormat format);
+  // Pixel bytes load_image_area with format sends for area, unaligned 1bpp goes as 8bpp
+  [[nodiscard]] static uint64_t transfer_bytes(const IT8951Area& area, PixelFormat format);
+  // Makes the display engine read image buffers as packed 1bpp, the loads above switch it themselves
+  void set_1bpp_mode(bool enable);
+
+  // Bytes sent per image upload command, a load image area header included
+  [[nodiscard]] size_t get_transfer_size() const { return transfer_size; }
+  void set_transfer_size(size_t size);
+
+  /**
+   * Number of image chunks load_image_area keeps queued at the kernel, 1 sends them one
+   * by one with blocking SG_IO calls. Capped at SPT_MAX_IN_FLIGHT.
+   */
+  [[nodiscard]] size_t get_max_in_flight() const { return max_in_flight; }
+  void set_max_in_flight(size_t requests);
+
+  /**
+   * Fast write memory needs the panel width to find the buffer rows, so switching to it
+   * reads the system info and fails without it. Areas whose rows aren't contiguous in the
+   * image buffer (partial width, stride, packed 1bpp) still use load image area.
+   */
+  [[nodiscard]] UploadEngine get_upload_engine() const { return upload_engine; }
+  bool                       set_upload_engine(UploadEngine engine);
+
+  // Per command counts, bytes and latencies of everything sent to the controller
+  [[nodiscard]] const std::shared_ptr<TransportMetrics>& get_transport_metrics() const {
+    return driver.get_metrics();
+  }
 
-  void load_image_area(const IT8951ImgLoadArea& area, std::span<uint8_t> pixelData) const;
-  void load_image_area(const IT8951Area& area, std::span<uint8_t> pixelData);
+  /**
+   * Times full frame uploads with growing transfer sizes up to what the device accepts
+   * and keeps the fastest. Overwrites the controller's image buffer.
+   * @param cache_file optional file remembering the result per device path
+   * @return the chosen transfer size
+   */
+  size_t autotune_transfer_size(const std::filesystem::path& cache_file = {});
 
   void display_image_area(const IT8951DisplayArea& area) const;
   void display_image_area(const IT8951Area& area, WaveMode wavemode);
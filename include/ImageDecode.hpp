@@ -0,0 +1,52 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <opencv2/core.hpp>
+
+struct ImageHeader {
+  enum class Codec : uint8_t { Jpeg, Png };
+  Codec    codec;
+  // Size of the decoded image, after the EXIF orientation imread applies
+  uint32_t width;
+  uint32_t height;
+};
+
+/**
+ * Reads the size of a JPEG or PNG from its header without decoding any pixels. For a
+ * JPEG this walks the markers up to the frame header, picking up the EXIF orientation.
+ * @return nullopt for other formats or a damaged header
+ */
+std::optional<ImageHeader> read_image_header(const std::filesystem::path& path);
+std::optional<ImageHeader> read_image_header(std::span<const uint8_t> encoded);
+
+/**
+ * Largest of 1, 2, 4 and 8 the image can be shrunk by while decoding and still cover a
+ * width x height panel after rotation, so the final resize never has to enlarge it.
+ * Only JPEGs are reduced, libjpeg scales their DCT blocks and skips most of the work.
+ * Other formats would be decoded in full and resized by imread anyway, they get 1.
+ * @param rotation cv::RotateFlags value applied when rendering
+ */
+uint32_t reduced_decode_factor(const ImageHeader& header, int rotation, uint32_t width, uint32_t height);
+
+struct DecodeTimings {
+  std::chrono::nanoseconds header{0};
+  std::chrono::nanoseconds decode{0};
+  uint32_t                 factor = 1;  // Image was decoded at 1/factor of its size
+};
+
+/**
+ * Decodes an image to 8bpp gray at the smallest size that still covers the panel, see
+ * reduced_decode_factor. Falls back to a full decode when the header can't be read.
+ * @return an empty Mat when decoding fails
+ */
+cv::Mat decode_for_panel(const std::filesystem::path& path, int rotation, uint32_t width, uint32_t height,
+                         DecodeTimings* timings = nullptr);
+cv::Mat decode_for_panel(std::span<const uint8_t> encoded, int rotation, uint32_t width, uint32_t height,
+                         DecodeTimings* timings = nullptr);
@@ -0,0 +1,24 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <opencv2/core.hpp>
+#include <span>
+
+/**
+ * Rotates, bilinearly resamples and quantizes src into a width x height panel frame in
+ * a single pass, replacing cv::rotate, cv::resize and the quantize copy. The output is
+ * walked in tiles so the source rows touched by a 90 degree rotation stay in cache.
+ * @param src 8bpp source image
+ * @param rotation cv::RotateFlags value, anything else leaves the image unrotated
+ * @param quantization table from quantization_table, applied to every output pixel
+ * @param dst receives width * height bytes, rows are width bytes apart
+ * @param memory where the per row and column resampling tables live during the call
+ */
+void render_to_panel(const cv::Mat& src, int rotation, uint32_t width, uint32_t height,
+                     const std::array<uint8_t, 256>& quantization, std::span<uint8_t> dst,
+                     std::pmr::memory_resource* memory = std::pmr::get_default_resource());
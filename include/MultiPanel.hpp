@@ -0,0 +1,73 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "DisplayWorker.hpp"
+
+struct PanelInfo {
+  std::string      path;
+  IT8951SystemInfo info;
+};
+
+// Device nodes that could be an IT8951, /dev/sg* on Linux
+std::vector<std::string> panel_candidates();
+
+/**
+ * Probes all candidates at the same time, a node that doesn't answer the inquiry only
+ * costs its own timeout instead of delaying the others.
+ * @return the IT8951 panels found, in candidate order
+ */
+std::vector<PanelInfo> discover_panels(const std::vector<std::string>& candidates = panel_candidates());
+
+/**
+ * Drives several panels at once, each from its own DisplayWorker so every device has
+ * its own queue and transfers run side by side. Updating all panels takes about as
+ * long as the slowest one.
+ */
+class MultiPanelManager {
+ public:
+  using PanelJob = std::function<DisplayStats(size_t panel, ScreenManager& screen)>;
+
+  explicit MultiPanelManager(std::vector<ScreenManager>&& screens, size_t queue_capacity = 2);
+  // Opens every path, panels that fail to open are left out
+  static MultiPanelManager open(const std::vector<std::string>& paths, size_t queue_capacity = 2);
+
+  MultiPanelManager(const MultiPanelManager&)            = delete;
+  MultiPanelManager& operator=(const MultiPanelManager&) = delete;
+  MultiPanelManager(MultiPanelManager&&)                 = default;
+
+  [[nodiscard]] size_t size() const { return panels.size(); }
+
+  // Runs job on every panel in parallel and waits for all of them, results are in panel order
+  std::vector<DisplayJobResult> run_on_all(const PanelJob& job);
+
+  // The same image on every panel
+  std::vector<DisplayJobResult> display(const std::filesystem::path& path);
+  // One image per panel, panels without a path are left alone
+  std::vector<DisplayJobResult> display(const std::vector<std::filesystem::path>& paths);
+  /**
+   * Splits frame into a grid of equal cells, columns wide and filled row by row, and
+   * shows cell i on panel i.
+   */
+  std::vector<DisplayJobResult> display_tiled(const cv::Mat& frame, uint32_t columns);
+
+ private:
+  // Shared with the workers' notify callbacks, so it has to stay put when the manager moves
+  struct Completions {
+    std::mutex              mutex;
+    std::condition_variable changed;
+    uint64_t                generation = 0;  // Bumped on every completion
+  };
+
+  std::unique_ptr<Completions>                completions = std::make_unique<Completions>();
+  std::vector<std::unique_ptr<DisplayWorker>> panels;
+  std::unique_ptr<std::mutex>                 run_mutex = std::make_unique<std::mutex>();
+};
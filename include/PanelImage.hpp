@@ -0,0 +1,78 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <opencv2/core.hpp>
+#include "IT8951.hpp"
+#include "PixelFormat.hpp"
+
+// Files with this extension are shown by ScreenManager::display without decoding
+constexpr std::string_view panel_image_extension = ".it8951";
+
+/**
+ * Start of a pre-rendered panel image. The rows follow at data_offset, each row_bytes
+ * long and laid out the way the load image command wants them: packed like pack_pixels
+ * for 1bpp, one quantized byte per pixel otherwise. Fields are little endian.
+ */
+struct PanelImageHeader {
+  std::array<char, 4>    magic{'I', 'T', 'P', 'I'};
+  uint32_t               version  = 1;
+  uint32_t               width    = 0;
+  uint32_t               height   = 0;
+  int32_t                rotation = -1;  // cv::RotateFlags applied when rendering, -1 for none
+  PixelFormat            format   = PixelFormat::Bpp8;
+  std::array<uint8_t, 3> reserved{};
+  WaveMode               wavemode    = WaveMode::GC16;  // Waveform the image is meant to be shown with
+  uint32_t               row_bytes   = 0;
+  uint32_t               data_offset = 0;
+};
+static_assert(sizeof(PanelImageHeader) == 36);
+
+// Rows start this far into the file, so they stay aligned for whoever reads them
+constexpr uint32_t panel_image_data_offset = 64;
+
+/**
+ * A panel image mapped into memory read-only. rows() points straight into the mapping,
+ * so it can be handed to IT8951::load_prepared_image_area without a copy.
+ */
+class PanelImage {
+ public:
+  // nullopt when the file can't be mapped or isn't a valid panel image
+  static std::optional<PanelImage> open(const std::filesystem::path& path);
+
+  PanelImage(const PanelImage&)            = delete;
+  PanelImage& operator=(const PanelImage&) = delete;
+  PanelImage(PanelImage&& other) noexcept;
+  PanelImage& operator=(PanelImage&& other) noexcept;
+  ~PanelImage();
+
+  [[nodiscard]] const PanelImageHeader&  header() const { return *reinterpret_cast<const PanelImageHeader*>(mapping); }
+  [[nodiscard]] std::span<const uint8_t> rows() const {
+    return {mapping + header().data_offset, static_cast<size_t>(header().row_bytes) * header().height};
+  }
+
+ private:
+  const uint8_t* mapping = nullptr;
+  size_t         size    = 0;
+#ifdef WIN32
+  void* file_mapping = nullptr;
+#endif
+
+  PanelImage() = default;
+  void unmap();
+};
+
+/**
+ * Writes a frame that was rendered for the panel, i.e. rotated, scaled and quantized or
+ * dithered to format, as a panel image. 1bpp frames are packed, a width that isn't
+ * aligned for 1bpp loads is stored as 8bpp like IT8951::load_image_area would send it.
+ */
+bool write_panel_image(const std::filesystem::path& path, const cv::Mat& frame, PixelFormat format,
+                       int rotation, WaveMode wavemode);
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+enum class PixelFormat : uint8_t {
+  Bpp1 = 1,
+  Bpp2 = 2,
+  Bpp4 = 4,
+  Bpp8 = 8,
+};
+
+// Per-panel gray correction applied before quantizing, indexed by source gray value
+using ToneMap = std::array<uint8_t, 256>;
+
+constexpr uint32_t bits_per_pixel(PixelFormat format) { return static_cast<uint32_t>(format); }
+
+constexpr size_t packed_row_bytes(uint32_t width, PixelFormat format) {
+  return (static_cast<size_t>(width) * bits_per_pixel(format) + 7) / 8;
+}
+
+// 1bpp loads are sent as bytes and the controller wants those 32 bit aligned
+constexpr uint32_t pixel_alignment(PixelFormat format) {
+  return format == PixelFormat::Bpp1 ? 32 : 1;
+}
+
+/**
+ * Quantizes 8bpp pixels to the gray levels of format and packs them into rows of
+ * packed_row_bytes(width, format), first pixel in the lowest bits of a byte.
+ * @param src first pixel of the source, rows are src_stride bytes apart
+ * @param dst receives height rows of packed_row_bytes(width, format)
+ * @param tone_map optional correction applied before quantizing
+ */
+void pack_pixels(std::span<const uint8_t> src, size_t src_stride, uint32_t width,
+                 uint32_t height, PixelFormat format, std::span<uint8_t> dst,
+                 const ToneMap* tone_map = nullptr);
+
+// Maps a source gray value to its quantized level spread over 0-255, tone map included
+std::array<uint8_t, 256> quantization_table(PixelFormat format, const ToneMap* tone_map = nullptr);
+
+/**
+ * Quantizes 8bpp pixels to the gray levels of format but keeps one byte per pixel,
+ * levels are spread over the full 0-255 range.
+ * @param dst receives height rows of width bytes
+ */
+void quantize_pixels(std::span<const uint8_t> src, size_t src_stride, uint32_t width,
+                     uint32_t height, PixelFormat format, std::span<uint8_t> dst,
+                     const ToneMap* tone_map = nullptr);
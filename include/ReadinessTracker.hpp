@@ -0,0 +1,72 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+enum class WaveMode : uint32_t;
+
+/**
+ * Predicts when the controller finishes refreshing from the waveform frame counts and
+ * only polls its status near that moment, learning the real frame time on the way.
+ */
+class ReadinessTracker {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Reads LUTAFSR, 0 when all LUT engines are idle
+  using StatusReader = std::function<std::optional<uint32_t>()>;
+
+  explicit ReadinessTracker(StatusReader reader);
+  ReadinessTracker(const ReadinessTracker&)            = delete;
+  ReadinessTracker& operator=(const ReadinessTracker&) = delete;
+  ~ReadinessTracker();
+
+  void set_reader(StatusReader reader);
+  void set_frame_counts(std::span<const unsigned int, 8> counts);
+
+  // Called right after a display command was sent
+  void refresh_started(WaveMode mode, uint64_t pixels);
+
+  [[nodiscard]] Clock::time_point predicted_ready() const;
+  [[nodiscard]] std::chrono::duration<double, std::milli> frame_time() const;
+
+  // Blocks the calling thread, false on timeout or when the status can't be read
+  bool wait_until_ready();
+
+  /**
+   * Waits on a background thread instead.
+   * @param callback optional, called from that thread with the result
+   */
+  std::future<bool> when_ready(std::function<void(bool)> callback = {});
+
+ private:
+  struct Waiter {
+    std::promise<bool>        promise;
+    std::function<void(bool)> callback;
+  };
+
+  mutable std::mutex      mutex;
+  std::condition_variable waiters_changed;
+  StatusReader            reader;
+  std::array<uint32_t, 8> frame_counts{};
+  double                  frame_time_ms = 1000.0 / 85;  // ~85Hz until measured
+  Clock::time_point       busy_since;
+  Clock::time_point       busy_until;
+  uint32_t                busy_frames = 0;  // Sum of the frames of refreshes since idle
+  std::vector<Waiter>     waiters;
+  std::thread             worker;
+  bool                    stopping = false;
+
+  void run_worker();
+};
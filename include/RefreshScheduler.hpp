@@ -0,0 +1,59 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "IT8951.hpp"
+
+struct ScheduledUpdate {
+  IT8951Area                            area;
+  WaveMode                              wavemode;
+  std::chrono::steady_clock::time_point queued;
+};
+
+struct RefreshPolicy {
+  // Longest an update waits for the controller before it's flushed anyway
+  std::chrono::milliseconds latency_budget{100};
+  // A full GC16 refresh is inserted after this many partial updates, 0 never does
+  uint32_t full_refresh_interval = 20;
+  // Rectangles closer than this many pixels are merged into one
+  uint32_t merge_distance = 16;
+};
+
+/**
+ * Collects region updates, merges overlapping and nearby ones and decides when the
+ * merged set should be sent to the controller.
+ */
+class RefreshScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Batch {
+    std::vector<ScheduledUpdate> updates;
+    bool                         full_refresh = false;
+  };
+
+  RefreshPolicy policy;
+
+  void add(const IT8951Area& area, WaveMode wavemode, Clock::time_point now = Clock::now());
+
+  // Due once the controller is idle, or when the oldest update used up its latency budget
+  [[nodiscard]] bool due(Clock::time_point controller_ready, Clock::time_point now = Clock::now()) const;
+  // When due turns true at the latest, nullopt with nothing queued
+  [[nodiscard]] std::optional<Clock::time_point> due_at(Clock::time_point controller_ready) const;
+
+  // Hands out everything queued and counts it towards the next full refresh
+  Batch take();
+
+  void clear() { updates.clear(); }
+
+  [[nodiscard]] bool empty() const { return updates.empty(); }
+
+ private:
+  std::vector<ScheduledUpdate> updates;
+  uint32_t                     partial_updates = 0;
+};
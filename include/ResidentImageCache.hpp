@@ -0,0 +1,94 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <cstdint>
+#include <list>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "PixelFormat.hpp"
+#include "ReadinessTracker.hpp"
+
+/**
+ * Identifies rendered image content, independent of where it came from. Keys only compare
+ * equal when a second, independently computed hash matches as well, so a collision of the
+ * lookup hash alone is a miss instead of showing another image.
+ */
+struct ResidentImageKey {
+  uint64_t    hash;
+  uint64_t    verifier;
+  uint32_t    width;
+  uint32_t    height;
+  PixelFormat format;
+
+  bool operator==(const ResidentImageKey&) const = default;
+
+  // Hashes height rows of width bytes, stride bytes apart, both hashes in one pass
+  static ResidentImageKey for_pixels(std::span<const uint8_t> pixels, size_t stride, uint32_t width,
+                                     uint32_t height, PixelFormat format);
+};
+
+// An image held in controller memory, laid out like an image buffer so it can be displayed from there
+struct ResidentImage {
+  uint32_t address;
+  // When the last refresh reading from the slot is predicted to end
+  ReadinessTracker::Clock::time_point busy_until{};
+};
+
+struct ResidentImageCacheStats {
+  uint64_t hits      = 0;
+  uint64_t misses    = 0;
+  uint64_t evictions = 0;
+  uint32_t resident  = 0;
+  uint32_t slots     = 0;
+};
+
+/**
+ * Bookkeeping for images kept in the controller's SDRAM beyond the image buffers. Memory
+ * is split into panel sized slots because the display engine reads rows panel width
+ * apart; slots are handed out from a free list and the least recently used image gives
+ * up its slot once they run out. Nothing here talks to the device, the caller uploads
+ * into the slots it's given.
+ */
+class ResidentImageCache {
+ public:
+  // count slots of slot_bytes each from base on, drops everything resident
+  void configure(uint32_t base, uint32_t slot_bytes, uint32_t count);
+
+  // Counts a hit or miss and marks the image as most recently used
+  ResidentImage* find(const ResidentImageKey& key);
+  /**
+   * Reserves a slot for key, evicting the least recently used image when none is free.
+   * The returned busy_until is the slot's, wait for it before overwriting the slot.
+   * @return nullptr without slots
+   */
+  ResidentImage* insert(const ResidentImageKey& key);
+  // Frees the slot of key, e.g. after its upload failed
+  void erase(const ResidentImageKey& key);
+  void clear();
+
+  [[nodiscard]] uint32_t                slot_count() const { return static_cast<uint32_t>(slots.size()); }
+  [[nodiscard]] ResidentImageCacheStats stats() const;
+
+ private:
+  struct KeyHash {
+    size_t operator()(const ResidentImageKey& key) const { return key.hash; }
+  };
+  using Entry = std::pair<ResidentImageKey, ResidentImage>;
+
+  uint32_t base       = 0;
+  uint32_t slot_bytes = 0;
+  // Slot addresses, with the busy time of slots that aren't resident right now
+  std::vector<ResidentImage> slots;
+  std::vector<uint32_t>      free_slots;
+  // Most recently used first
+  std::list<Entry>                                                          entries;
+  std::unordered_map<ResidentImageKey, std::list<Entry>::iterator, KeyHash> index;
+  uint64_t                                                                  hits      = 0;
+  uint64_t                                                                  misses    = 0;
+  uint64_t                                                                  evictions = 0;
+
+  void release(std::list<Entry>::iterator entry);
+};
@@ -4,12 +4,22 @@
 */
 #pragma once
 #include <filesystem>
+#include <memory>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <optional>
 #include <utility>
+#include "DirtyRegion.hpp"
+#include "Dither.hpp"
+#include "FrameArena.hpp"
+#include "FrameCache.hpp"
 #include "IT8951.hpp"
+#include "ImagePipeline.hpp"
+#include "PanelImage.hpp"
+#include "RefreshScheduler.hpp"
+#include "ResidentImageCache.hpp"
+#include "WaveformSelection.hpp"
 using namespace cv;
 
 class ScreenManager {
@@ -17,28 +27,152 @@ class ScreenManager {
   IT8951                 it;
   const IT8951SystemInfo info;
   int                    rotation = 1;
+  // What the controller's image buffer and the panel currently hold, only valid inside shadow_area
+  Mat  shadow;
+  Rect shadow_area;
+  PixelFormat            pixel_format = PixelFormat::Bpp8;
+  bool                   auto_waveform = false;
+  std::optional<ToneMap> tone_map;
+  DitherMode             dither_mode = DitherMode::None;
+  // Frames are uploaded into the back buffer while the panel refreshes from the others
+  uint32_t image_buffer_count = 1;
+  // Whether the caller vouched for the layout image_buffer_address assumes
+  bool image_buffer_layout_confirmed = false;
+  uint32_t back_buffer        = 0;
+  bool     back_buffer_used   = false;
+  // When the last refresh reading from each image buffer is predicted to end
+  std::vector<ReadinessTracker::Clock::time_point> buffer_busy_until;
+  RefreshScheduler                                 scheduler;
+  // Shadow plus the region updates that haven't been flushed yet
+  Mat pending_frame;
+  // Reused between frames so display doesn't allocate a panel sized image each time
+  std::vector<uint8_t> frame_buffer;
+  // Rendered frames of recently displayed files
+  FrameCache frame_cache;
+  // Rendered frames kept in controller memory past the image buffers
+  ResidentImageCache resident_images;
+  // Scratch memory of the display path, so showing same sized frames over and over stays off the heap
+  std::unique_ptr<FrameArena> arena;
+  // Error diffusion threads, started with the first error diffusing dither mode
+  std::unique_ptr<WorkerPool> dither_pool;
 
-  static std::optional<Mat> load_image(const std::filesystem::path& image_path);
+  /**
+   * Assumes the controller's image buffers are panel sized, one byte per pixel, and follow
+   * each other from uiImageBufBase. The controller only reports the base and the count, so
+   * this is a guess that holds for the firmware it was written against. Only buffer 0 is
+   * used until the caller confirms it with set_image_buffer_layout_confirmed.
+   */
+  [[nodiscard]] uint32_t image_buffer_address(uint32_t index) const;
+  // Whether the shadow holds what the panel shows for all of area
+  [[nodiscard]] bool shadow_known(const Rect& area) const;
+  // Moves on to the next back buffer once the current one was uploaded to
+  void finish_frame();
 
-  Mat scale_image_to_display(const Mat& img) const;
+  static constexpr uint32_t dirty_tile_size   = 32;
+  static constexpr size_t   max_dirty_regions = 16;
 
-  void display_image(const Mat& img, const IT8951DisplayArea& area);
+  // Decoded to 8bpp gray, reduced while decoding when it's much larger than the panel
+  std::optional<Mat> load_image(const std::filesystem::path& image_path) const;
+
+  // Rotated, scaled to the panel and quantized to pixel_format, backed by frame_buffer
+  Mat render_to_display(const Mat& img);
+  // Tone maps and quantizes src into dst, dithering if enabled
+  void quantize_into(const Mat& src, Mat& dst);
+
+  DisplayStats display_image(const Mat& img, const IT8951DisplayArea& area, bool full = false);
+  /**
+   * Shows a rendered, panel sized frame, replacing queued region updates. With
+   * keep_resident it goes through the resident image cache when that has slots.
+   */
+  DisplayStats display_frame(const Mat& scaled_img, WaveMode wavemode = WaveMode::GC16, bool keep_resident = false);
+  // Displays frame from its controller memory slot, uploading it there first unless it's resident
+  DisplayStats display_resident(const Mat& frame, WaveMode wavemode);
+  // Uploads a pre-rendered file without decoding it or touching its pixels
+  DisplayStats display_prepared(const PanelImage& image);
+  // Copies img into pending_frame and queues it, false when it's outside the panel
+  bool queue_region(const Mat& img, uint32_t x, uint32_t y, WaveMode wavemode);
 
  public:
   ScreenManager(IT8951&& it);
   ScreenManager(IT8951&& it, double vCom);
   ScreenManager(const ScreenManager&)            = delete;
   ScreenManager& operator=(const ScreenManager&) = delete;
-  ScreenManager(ScreenManager&& other) : it(std::move(other.it)), info(other.info), rotation(other.rotation){};
+  ScreenManager(ScreenManager&& other) = default;
 //    ScreenManager& operator=(ScreenManager&& other) {
 //      std::swap(this->it, other.it);
 //      const_cast<IT8951SystemInfo&>(info) = other.info;
 //      return *this;
 //    };
 
-  void display(const std::filesystem::path& path);
+  // Files ending in panel_image_extension are mapped and sent as they are
+  DisplayStats display(const std::filesystem::path& path);
+  // Rotates, scales and quantizes an 8bpp image like display(path) does, without decoding a file
+  DisplayStats display(const Mat& img);
+
+  /**
+   * Shows a frame that was already rotated, scaled and quantized to the pixel format,
+   * e.g. by the render stages of a FrameStream. It has to fit the panel.
+   */
+  DisplayStats display_rendered(const Mat& frame, WaveMode wavemode);
+
+  /**
+   * Queues img to be shown at x,y. Queued regions are merged and sent together once the
+   * controller is idle or the latency budget runs out. That's only checked when this,
+   * flush or flush_if_due is called; nothing runs in the background, so call flush_if_due
+   * by next_flush_due. A DisplayWorker does that on its own between jobs.
+   */
+  DisplayStats update_region(const Mat& img, uint32_t x, uint32_t y, WaveMode wavemode = WaveMode::GC16);
+  // Like update_region, but sends the region together with everything queued right away
+  DisplayStats display_region(const Mat& img, uint32_t x, uint32_t y, WaveMode wavemode = WaveMode::GC16);
+  // Sends all queued regions now
+  DisplayStats flush();
+  DisplayStats flush_if_due();
+  // When queued regions are due to be flushed, nullopt when nothing is queued
+  [[nodiscard]] std::optional<ReadinessTracker::Clock::time_point> next_flush_due() const;
+  void         set_refresh_policy(const RefreshPolicy& policy);
 
   void clear_screen();
+  bool wait_until_ready();
+  [[nodiscard]] ReadinessTracker::Clock::time_point predicted_ready() const;
+  [[nodiscard]] const IT8951SystemInfo&             get_system_info() const { return info; }
+  [[nodiscard]] int                                 get_rotation() const { return rotation; }
   void set_vcom(double vcom);
   void set_rotation(int rotation);
+  void set_pixel_format(PixelFormat format);
+  void set_tone_map(const std::optional<ToneMap>& map);
+  void set_dither_mode(DitherMode mode);
+  // Memory the frame cache may use in bytes, 0 disables it
+  void            set_frame_cache_size(size_t bytes);
+  FrameCacheStats frame_cache_stats() const;
+  /**
+   * Keeps up to slots frames shown by display in the controller's memory, showing one
+   * again only sends the display command. Slots are panel sized and follow the image
+   * buffers the controller reports; it doesn't report its memory size, so make sure
+   * uiImageBufBase + (uiNumImgBuf + slots) * width * height fits. 0, the default, disables it.
+   * Frames are recognised by two independent 64 bit hashes of their pixels, not by comparing
+   * them; two different frames matching in both would show the older one.
+   * @return false when slots were requested without a confirmed image buffer layout
+   */
+  bool                    set_resident_image_slots(uint32_t slots);
+  ResidentImageCacheStats resident_image_stats() const;
+  // Drops the cached frames of path, or all of them when path is empty
+  void invalidate_frame_cache(const std::filesystem::path& path = {});
+  // Pick the waveform per updated region from its content instead of the requested one
+  void set_auto_waveform(bool enabled);
+  size_t autotune_transfer_size(const std::filesystem::path& cache_file);
+  void set_max_in_flight(size_t requests);
+  bool set_upload_engine(UploadEngine engine);
+  // Stays valid after the ScreenManager is moved, e.g. into a DisplayWorker
+  [[nodiscard]] std::shared_ptr<TransportMetrics> get_transport_metrics() const;
+  /**
+   * Confirms the controller lays out its image buffers the way image_buffer_address
+   * assumes, e.g. after checking its firmware documentation. Double buffering and resident
+   * images write past buffer 0 and need this first.
+   */
+  void set_image_buffer_layout_confirmed(bool confirmed);
+  /**
+   * Clamped to the number of image buffers the controller reports, 1 by default.
+   * @return false, keeping a single buffer, when more are requested without a confirmed layout
+   */
+  bool set_image_buffer_count(uint32_t count);
 };
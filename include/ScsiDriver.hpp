@@ -12,24 +12,102 @@
 #endif
 
 #include "log.hpp"
+#include "TransportMetrics.hpp"
 #include <stdint.h>
 #include <array>
+#include <chrono>
+#ifdef IT8951_VIRTUAL_DEVICE
+#include <deque>
+#endif
+#include <memory>
 #include <optional>
 #include <span>
+#include <string>
 #include <vector>
 
 #define SPT_BUF_SIZE (60 * 1024)
+// Largest transfer we ever ask the kernel for, the device limits usually end up lower
+#define SPT_MAX_BUF_SIZE (1024 * 1024)
+// Upper bound for the number of segments handed to the kernel in one vectored write
+#define SPT_MAX_SEGMENTS 128
+
+// sg only keeps this many commands queued per file descriptor
+#define SPT_MAX_IN_FLIGHT 16
+
+struct ScsiCompletion {
+    uint32_t id;
+    bool ok;
+    uint8_t status;         // SCSI status
+    uint16_t host_status;
+    uint16_t driver_status;
+    int resid;              // bytes that weren't transferred
+    uint32_t duration_ms;
+};
+
+#ifdef IT8951_VIRTUAL_DEVICE
+class VirtualIT8951;
+#endif
 
 class ScsiDriver {
 #ifdef WIN32
     HANDLE hDev = nullptr;
 #endif
 #ifdef __linux__
-    int fd = 0;
+    // Replaced when queued requests are abandoned
+    mutable int fd = 0;
+#endif
+    std::string path;
+    size_t max_transfer = SPT_BUF_SIZE;
+    size_t max_segments = SPT_MAX_SEGMENTS;
+    mutable uint32_t next_request_id = 1;
+    mutable size_t in_flight = 0;
+    std::shared_ptr<TransportMetrics> metrics = std::make_shared<TransportMetrics>();
+    // Queued requests by id % SPT_MAX_IN_FLIGHT, so they can be recorded when they complete
+    struct SubmittedRequest {
+        std::chrono::steady_clock::time_point time;
+        size_t bytes;
+        TransportCommand command;
+    };
+    mutable std::array<SubmittedRequest, SPT_MAX_IN_FLIGHT> submitted{};
+    // Completions read while making room for a submit, handed out by wait_for_completion before new ones
+    mutable std::array<ScsiCompletion, SPT_MAX_IN_FLIGHT> collected{};
+    mutable size_t collected_count = 0;
+#ifdef WIN32
+    mutable std::vector<ScsiCompletion> completed;
 #endif
+#ifdef IT8951_VIRTUAL_DEVICE
+    std::shared_ptr<VirtualIT8951> device;
+    // Submitted requests with the time the modelled link finishes them, in order
+    mutable std::deque<std::pair<std::chrono::steady_clock::time_point, ScsiCompletion>> pending;
+#endif
+
+    void query_transfer_limits();
+
+    // Waits for the next request the backend finishes
+    std::optional<ScsiCompletion> next_completion(int timeoutMs) const;
+
+    // Frees a queue slot for submit_write, keeping the completion for the caller
+    bool collect_completion() const;
+
+    using Segments = std::array<std::span<const uint8_t>, SPT_MAX_SEGMENTS>;
+    // The header, then the rows as one segment when they're contiguous or one each otherwise
+    // @return number of segments used
+    static size_t make_strided_segments(Segments &segments, std::span<const uint8_t> header,
+                                        std::span<const uint8_t> rows, size_t rowBytes, size_t rowCount,
+                                        size_t stride);
+
 public:
+    // Standard INQUIRY data, vendor, product and revision included
+    using InquiryData = std::array<uint8_t, 36>;
+
     explicit ScsiDriver(const char *path);
 
+    /**
+     * Asks the device at path what it is without opening it for writing or setting it up like the
+     * constructor does, cheap enough to try on every candidate device.
+     */
+    static std::optional<InquiryData> inquiry(const char *path);
+
     ScsiDriver(ScsiDriver &) = delete;
 
     ScsiDriver(ScsiDriver &&);
@@ -44,12 +122,73 @@ public:
             unsigned long dataTransferLength,
             std::span<const uint8_t, 16> commandDescriptorBlock) const;
 
+    // Reads into the caller's buffer, the number of bytes received on success
+    std::optional<size_t> get_data(std::span<uint8_t> buffer,
+                                   std::span<const uint8_t, 16> commandDescriptorBlock) const;
+
     bool write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
                     std::span<const uint8_t> data) const;
 
+    /**
+     * Writes the segments as one transfer without joining them first.
+     * On linux this uses the sg driver's iovec support, at most SPT_MAX_SEGMENTS segments.
+     */
+    bool write_data_vectored(std::span<const uint8_t, 16> commandDescriptorBlock,
+                             std::span<const std::span<const uint8_t>> segments) const;
+
+    /**
+     * Writes header followed by rowCount rows of rowBytes that are stride bytes apart,
+     * e.g. a sub-rectangle of a larger image.
+     */
+    bool write_data_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                            std::span<const uint8_t> header, std::span<const uint8_t> rows,
+                            size_t rowBytes, size_t rowCount, size_t stride) const;
+
+    /**
+     * Queues a write without waiting for it, see wait_for_completion.
+     * The data segments must stay alive until the request completes.
+     * @return id to match the completion against
+     */
+    std::optional<uint32_t> submit_write(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                         std::span<const std::span<const uint8_t>> segments) const;
+
+    std::optional<uint32_t> submit_write_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                                 std::span<const uint8_t> header, std::span<const uint8_t> rows,
+                                                 size_t rowBytes, size_t rowCount, size_t stride) const;
+
+    /**
+     * Waits for any submitted request to finish, nullopt on timeout or when nothing is queued.
+     * Every submitted request is handed out here exactly once, also those submit_write had to wait for.
+     */
+    std::optional<ScsiCompletion> wait_for_completion(int timeoutMs = 10000) const;
+
+    /**
+     * Forgets every queued request, for when the device stopped answering.
+     * Their completions are never handed out and their data isn't touched after this returns,
+     * on linux the device is reopened to get there.
+     */
+    void abandon_in_flight() const;
+
+    // Submitted requests whose completion wasn't handed out yet
+    size_t in_flight_count() const { return in_flight + collected_count; }
+
+    const std::string &get_path() const { return path; }
+
+    // Largest single data transfer the kernel and the device accept, found when opening
+    size_t max_transfer_size() const { return max_transfer; }
+
+    // Largest number of segments for write_data_vectored
+    size_t max_segment_count() const { return max_segments; }
+
+    // Counters for every command sent, shared so they can be read while the driver is busy on another thread
+    const std::shared_ptr<TransportMetrics> &get_metrics() const { return metrics; }
+
 #ifdef WIN32
     HANDLE get_handle() const { return hDev; }
 #endif
+#ifdef IT8951_VIRTUAL_DEVICE
+    VirtualIT8951 &get_device() const { return *device; }
+#endif
 #ifdef __linux__
 
     int get_fd() const { return fd; }
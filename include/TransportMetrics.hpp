@@ -0,0 +1,98 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Commands counted separately, everything else ends up in Other
+enum class TransportCommand : uint8_t {
+  ReadRegister    = 0,  // 0x83
+  WriteRegister   = 1,  // 0x84
+  LoadImage       = 2,  // 0xA2
+  Display         = 3,  // 0x94
+  Pmic            = 4,  // 0xA3
+  ReadMemory      = 5,  // 0x81
+  WriteMemory     = 6,  // 0x82
+  FastWriteMemory = 7,  // 0xA5
+  Other           = 8,  // Inquiry, system info
+};
+constexpr size_t transport_command_count = 9;
+
+// Which counters a command descriptor block is recorded under
+TransportCommand transport_command(std::span<const uint8_t, 16> cdb);
+
+// Bucket i counts latencies below latency_bucket_bound(i), the last one everything above
+constexpr size_t latency_bucket_count = 20;
+constexpr std::chrono::microseconds latency_bucket_bound(size_t bucket) {
+  return std::chrono::microseconds(int64_t{16} << bucket);
+}
+
+struct TransportRecord {
+  size_t requested   = 0;  // Bytes the command asked to move
+  size_t transferred = 0;
+  // False when the request couldn't be submitted or the driver reports it failed
+  bool                     ok            = true;
+  uint8_t                  status        = 0;  // SCSI status, 0 is GOOD
+  uint16_t                 host_status   = 0;
+  uint16_t                 driver_status = 0;
+  std::chrono::nanoseconds latency{0};
+};
+
+struct CommandMetrics {
+  uint64_t                 commands        = 0;
+  uint64_t                 failed          = 0;
+  uint64_t                 status_errors   = 0;  // Non-zero SCSI status, e.g. CHECK CONDITION
+  uint64_t                 host_errors     = 0;
+  uint64_t                 driver_errors   = 0;
+  uint64_t                 short_transfers = 0;  // Fewer bytes moved than requested
+  uint64_t                 bytes           = 0;
+  std::chrono::nanoseconds total_latency{0};
+  std::chrono::nanoseconds max_latency{0};
+  std::array<uint64_t, latency_bucket_count> latency_histogram{};
+
+  // Upper bound of the bucket reaching the given fraction of the commands, at most max_latency
+  [[nodiscard]] std::chrono::microseconds latency_percentile(double fraction) const;
+};
+
+struct TransportMetricsSnapshot {
+  std::array<CommandMetrics, transport_command_count> commands{};
+
+  const CommandMetrics& operator[](TransportCommand command) const { return commands[static_cast<size_t>(command)]; }
+};
+
+/**
+ * Counters for every command a ScsiDriver sends. Recording is a handful of relaxed
+ * atomic adds so it stays on in the transfer path, a snapshot reads each counter on
+ * its own and may see a command that is only partly recorded.
+ */
+class TransportMetrics {
+ public:
+  void record(TransportCommand command, const TransportRecord& record);
+  void record(std::span<const uint8_t, 16> cdb, const TransportRecord& record) {
+    this->record(transport_command(cdb), record);
+  }
+
+  [[nodiscard]] TransportMetricsSnapshot snapshot() const;
+  void                                   reset();
+
+ private:
+  struct Counters {
+    std::atomic<uint64_t>                                   commands{0};
+    std::atomic<uint64_t>                                   failed{0};
+    std::atomic<uint64_t>                                   status_errors{0};
+    std::atomic<uint64_t>                                   host_errors{0};
+    std::atomic<uint64_t>                                   driver_errors{0};
+    std::atomic<uint64_t>                                   short_transfers{0};
+    std::atomic<uint64_t>                                   bytes{0};
+    std::atomic<int64_t>                                    total_latency_ns{0};
+    std::atomic<int64_t>                                    max_latency_ns{0};
+    std::array<std::atomic<uint64_t>, latency_bucket_count> latency_histogram{};
+  };
+  std::array<Counters, transport_command_count> counters;
+};
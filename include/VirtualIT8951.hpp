@@ -0,0 +1,104 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct VirtualDeviceConfig {
+  uint32_t width              = 1872;
+  uint32_t height             = 1404;
+  uint32_t image_buffer_count = 2;
+  uint32_t image_buffer_base  = 0x00119F00;
+  // Memory from image_buffer_base on, at least the image buffers
+  size_t sdram_bytes = 0;
+  // Waveform frames per WaveMode, like uiFrameCount
+  std::array<uint32_t, 8> frame_counts{50, 12, 38, 38, 38, 38, 20, 6};
+  double                  frame_time_ms = 1000.0 / 85;
+  // What USB 2.0 bulk transfers to the controller manage in practice
+  double                    usb_bytes_per_second = 30e6;
+  std::chrono::microseconds command_latency{250};
+  size_t                    max_transfer = 1024 * 1024;
+  // Scales every modelled duration before waiting on it, 0 doesn't wait at all
+  double time_scale = 1.0;
+};
+
+struct VirtualDeviceStats {
+  uint64_t                 commands      = 0;
+  uint64_t                 failed        = 0;
+  uint64_t                 bytes_written = 0;
+  uint64_t                 bytes_read    = 0;
+  uint64_t                 loads         = 0;
+  uint64_t                 displays      = 0;
+  std::chrono::nanoseconds link_busy{0};     // Modelled USB time, unscaled
+  std::chrono::nanoseconds refresh_busy{0};  // Modelled waveform time, unscaled
+};
+
+/**
+ * In-process IT8951 emulating the commands the library sends: inquiry, system info,
+ * register access (0x83/0x84), memory access (0x81/0x82/0xA5), load image area (0xA2),
+ * display area (0x94) and PMIC (0xA3). It keeps the controller's image buffers and what the panel shows, and models
+ * USB bandwidth, per-command latency and waveform durations from the frame counts.
+ * The ScsiDriver of the IT8951_VIRTUAL_LIB build talks to it instead of /dev/sg*.
+ */
+class VirtualIT8951 {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Result {
+    bool              ok;
+    size_t            transferred;
+    Clock::time_point done;  // When the modelled link finishes the command
+  };
+
+  explicit VirtualIT8951(const VirtualDeviceConfig& config = {});
+
+  // A ScsiDriver opened on path attaches to the device registered for it, or to a new default one
+  static std::shared_ptr<VirtualIT8951> attach(const std::string& path);
+  static void register_device(const std::string& path, std::shared_ptr<VirtualIT8951> device);
+  static void unregister_device(const std::string& path);
+
+  Result read(std::span<const uint8_t, 16> cdb, std::span<uint8_t> data);
+  Result write(std::span<const uint8_t, 16> cdb, std::span<const std::span<const uint8_t>> segments);
+
+  [[nodiscard]] const VirtualDeviceConfig& get_config() const { return config; }
+  [[nodiscard]] VirtualDeviceStats         stats() const;
+  void                                     reset_stats();
+  // What the panel currently shows, width * height gray bytes
+  [[nodiscard]] std::vector<uint8_t> panel_image() const;
+  // Whether the display engine is still running a waveform (LUTAFSR != 0)
+  [[nodiscard]] bool     busy() const;
+  [[nodiscard]] uint16_t vcom() const;
+
+ private:
+  mutable std::mutex                     mutex;
+  const VirtualDeviceConfig              config;
+  std::vector<uint8_t>                   memory;  // Image buffers, from image_buffer_base
+  std::vector<uint8_t>                   panel;
+  // Data of the command being written, kept so repeated commands don't allocate
+  std::vector<uint8_t>                   joined;
+  std::unordered_map<uint32_t, uint32_t> registers;
+  uint16_t                               vcom_mv = 0;
+  Clock::time_point                      link_free;
+  Clock::time_point                      lut_busy_until;
+  VirtualDeviceStats                     counters;
+
+  // Occupies the link for the command and returns when it's done
+  Clock::time_point transfer(size_t bytes);
+  // Pointer to size bytes of image buffer memory at address, nullptr when out of range
+  uint8_t* memory_at(uint32_t address, size_t size);
+  // Registers are also mapped into memory from 0x18000000 on, as little endian words
+  uint32_t register_value(uint32_t address);
+  bool     read_memory(uint32_t address, std::span<uint8_t> data);
+  bool     write_memory(uint32_t address, std::span<const uint8_t> data);
+  bool     load_image_area(std::span<const uint8_t> data);
+  bool     display_area(std::span<const uint8_t> data);
+};
@@ -0,0 +1,24 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <array>
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include "IT8951.hpp"
+
+// Pixel counts per panel gray level, i.e. per top nibble of an 8bpp pixel
+using GrayHistogram = std::array<uint64_t, 16>;
+
+GrayHistogram gray_histogram(const cv::Mat& img);
+
+/**
+ * Picks the fastest waveform that shows next cleanly on top of previous:
+ * A2 for black/white over black/white, DU for black/white over anything,
+ * GL16 for mostly black/white content with some gray like anti-aliased text
+ * and GC16 for everything else.
+ */
+WaveMode select_waveform(const GrayHistogram& next, const GrayHistogram& previous);
+
+WaveMode select_waveform(const cv::Mat& next, const cv::Mat& previous);
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Threads started once and handed the same kind of work over and over, e.g. the rows of
+ * every error diffused frame. Handing out work doesn't allocate, unlike starting threads
+ * per frame. One run at a time, it isn't meant to be shared between callers.
+ */
+class WorkerPool {
+ public:
+  // threads workers next to the thread calling run
+  explicit WorkerPool(unsigned threads);
+  WorkerPool(const WorkerPool&)            = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  ~WorkerPool();
+
+  /**
+   * Calls task(index) for every index below count, all at the same time so tasks may wait
+   * for each other. Index 0 runs on the calling thread. Returns once every task is done.
+   * @param count at most size() + 1
+   */
+  template <typename Task>
+  void run(unsigned count, Task& task) {
+    run(count, [](void* context, unsigned index) { (*static_cast<Task*>(context))(index); }, &task);
+  }
+
+  // Workers besides the calling thread
+  [[nodiscard]] unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+ private:
+  using Call = void (*)(void* context, unsigned index);
+
+  std::mutex               mutex;
+  std::condition_variable  work_changed;
+  std::condition_variable  work_done;
+  Call                     call    = nullptr;
+  void*                    context = nullptr;
+  // Workers taking part in the current run and those of them still busy
+  unsigned                 active     = 0;
+  unsigned                 pending    = 0;
+  uint64_t                 generation = 0;
+  bool                     stopping   = false;
+  std::vector<std::thread> workers;
+
+  void run(unsigned count, Call task, void* task_context);
+  void run_worker(unsigned index);
+};
@@ -9,9 +9,14 @@
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <cstdio>
+#include <new>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
 
 enum class LogLevel {
   Debug = 0,
@@ -28,15 +33,81 @@ fmt::text_style log_color(const LogLevel& lvl);
 
 char log_char(const LogLevel& ll);
 
+enum class LogOverflowPolicy {
+  Drop,   // Messages that don't fit in the queue are counted and thrown away
+  Block,  // The logging thread waits until the writer made room
+};
+
+/**
+ * Messages are queued in a fixed ring and written to stdout by a background thread, a
+ * call only claims a slot and copies its arguments into it. Arithmetic and enum
+ * arguments are formatted on the writer thread, anything else (strings, paths, views
+ * that may not outlive the call) is formatted into the slot right away and cut off at
+ * its size. Disabling it writes every message on the calling thread again.
+ */
+void set_async_logging(bool enabled);
+void set_log_overflow_policy(LogOverflowPolicy policy);
+// Messages thrown away because the queue was full
+uint64_t dropped_log_messages();
+// Waits until everything logged so far has been written
+void flush_log();
+
+namespace log_detail {
+constexpr size_t payload_size = 448;
+
+struct Record;
+using Formatter = void (*)(const Record& record, fmt::memory_buffer& out);
+
+struct Record {
+  LogLevel                              level;
+  std::chrono::system_clock::time_point time;
+  // Formats the captured arguments, nullptr when payload already holds the message
+  Formatter        format = nullptr;
+  fmt::string_view format_string;
+  uint32_t         length    = 0;
+  bool             truncated = false;
+  alignas(std::max_align_t) std::byte payload[payload_size];
+};
+
+// Arguments that stay valid when copied, so formatting them can wait for the writer
+template <typename T>
+constexpr bool deferrable = std::is_arithmetic_v<std::remove_cvref_t<T>> || std::is_enum_v<std::remove_cvref_t<T>>;
+
+// A free record for this message, nullptr when it was dropped
+Record* claim(LogLevel level);
+// Hands a claimed record to the writer
+void publish(Record* record);
+void set_text(Record* record, std::string_view text);
+}  // namespace log_detail
+
 void log(LogLevel level, std::string_view message);
 
 template <typename... T>
 void log(LogLevel const level, fmt::format_string<T...> message, T&&... ts) {
   if (!can_log(level)) return;
-  log(level, fmt::format(message, std::forward<T>(ts)...));
+  auto* record = log_detail::claim(level);
+  if (!record) return;
+  using Arguments = std::tuple<std::remove_cvref_t<T>...>;
+  if constexpr ((log_detail::deferrable<T> && ...) && sizeof(Arguments) <= log_detail::payload_size) {
+    new (record->payload) Arguments(ts...);
+    record->format_string = fmt::string_view(message);
+    record->format        = [](const log_detail::Record& r, fmt::memory_buffer& out) {
+      std::apply(
+          [&](const auto&... arguments) {
+            fmt::vformat_to(std::back_inserter(out), r.format_string, fmt::make_format_args(arguments...));
+          },
+          *std::launder(reinterpret_cast<const Arguments*>(r.payload)));
+    };
+  } else {
+    auto*      text   = reinterpret_cast<char*>(record->payload);
+    const auto result = fmt::format_to_n(text, log_detail::payload_size, message, std::forward<T>(ts)...);
+    record->length    = static_cast<uint32_t>(std::min(result.size, log_detail::payload_size));
+    record->truncated = result.size > log_detail::payload_size;
+  }
+  log_detail::publish(record);
 }
 
 #ifdef WIN32
 #include <Windows.h>
 std::string format_last_error(DWORD lastError);
-#endif
\ No newline at end of file
+#endif
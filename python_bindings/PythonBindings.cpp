@@ -4,10 +4,19 @@
 */
 #include "ScsiDriver.hpp"
 #include "IT8951.hpp"
+#include "DisplayWorker.hpp"
+#include "FrameStream.hpp"
+#include "MultiPanel.hpp"
 #include "ScreenManager.hpp"
 #include "log.hpp"
 
+#include <deque>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
 #include <pybind11/pybind11.h>
+#include <pybind11/chrono.h>
 #include <pybind11/stl.h>
 
 namespace py = pybind11;
@@ -16,17 +25,501 @@ ScreenManager create_screenmanager(const char *path, double vcom) {
     return {IT8951(ScsiDriver(path))};
 }
 
+// Wraps a 2-D uint8 buffer as a Mat without copying. Mat rows may be strided but their
+// pixels have to be adjacent, other layouts (e.g. transposed views) are gathered into a copy.
+Mat mat_from_buffer(const py::buffer_info &buffer) {
+    if (buffer.ndim != 2 || buffer.itemsize != 1 || buffer.format != py::format_descriptor<uint8_t>::format()) {
+        throw py::value_error("Expected a 2-D uint8 array");
+    }
+    const auto rows = static_cast<int>(buffer.shape[0]);
+    const auto cols = static_cast<int>(buffer.shape[1]);
+    if (buffer.strides[1] == 1 && buffer.strides[0] >= cols) {
+        return {rows, cols, CV_8UC1, buffer.ptr, static_cast<size_t>(buffer.strides[0])};
+    }
+    Mat copy(rows, cols, CV_8UC1);
+    const auto *base = static_cast<const uint8_t *>(buffer.ptr);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            copy.ptr<uint8_t>(row)[col] = base[row * buffer.strides[0] + col * buffer.strides[1]];
+        }
+    }
+    return copy;
+}
+
+// The buffer stays requested until the GIL is taken back, the transfer runs without it.
+// A ScreenManager still mustn't be used from several Python threads at the same time.
+template<auto Method>
+DisplayStats display_buffer_region(ScreenManager &self, const py::buffer &array, uint32_t x, uint32_t y,
+                                   WaveMode wavemode) {
+    const auto buffer = array.request();
+    const auto img = mat_from_buffer(buffer);
+    py::gil_scoped_release release;
+    return (self.*Method)(img, x, y, wavemode);
+}
+
+/**
+ * Runs a ScreenManager on a DisplayWorker and hands out asyncio futures for its jobs.
+ * The worker passes completions to the event loop with call_soon_threadsafe, so no
+ * Python thread is parked per call. Everything in State is only touched with the GIL held.
+ */
+class AsyncScreenManager {
+    struct State {
+        DisplayWorker *worker = nullptr;
+        QueueFullPolicy policy;
+        py::object loop = py::none();
+        std::unordered_map<uint64_t, py::object> futures;
+        // Jobs held back by QueueFullPolicy::Wait, submitted as completions free up room. At
+        // most the worker's capacity wait, so callers that don't await can't pile up frames
+        std::deque<std::pair<DisplayWorker::Job, py::object>> waiting;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    std::shared_ptr<TransportMetrics> metrics;
+    std::unique_ptr<DisplayWorker> worker;
+
+    static void track(State &state, uint64_t id, const py::object &future) { state.futures.emplace(id, future); }
+
+    static void drain(State &state) {
+        if (!state.worker) return;
+        for (auto &result: state.worker->take_completions()) {
+            auto node = state.futures.extract(result.id);
+            if (node.empty() || node.mapped().attr("done")().cast<bool>()) continue;
+            auto &future = node.mapped();
+            switch (result.status) {
+                case DisplayJobResult::Status::Done:
+                    future.attr("set_result")(py::cast(result.stats));
+                    break;
+                case DisplayJobResult::Status::Cancelled:
+                    future.attr("cancel")();
+                    break;
+                case DisplayJobResult::Status::Failed:
+                    future.attr("set_exception")(py::reinterpret_borrow<py::object>(PyExc_RuntimeError)(result.error));
+                    break;
+            }
+        }
+        while (!state.waiting.empty()) {
+            const auto id = state.worker->submit(state.waiting.front().first);
+            if (!id) break;
+            track(state, *id, state.waiting.front().second);
+            state.waiting.pop_front();
+        }
+    }
+
+    // Cancelling a future cancels its job too, unless the job is already running
+    static void on_done(State &state, const py::object &future) {
+        if (!future.attr("cancelled")().cast<bool>()) return;
+        for (auto it = state.futures.begin(); it != state.futures.end(); ++it) {
+            if (it->second.is(future)) {
+                if (state.worker) state.worker->cancel(it->first);
+                state.futures.erase(it);
+                return;
+            }
+        }
+        std::erase_if(state.waiting, [&](const auto &waiting) { return waiting.second.is(future); });
+    }
+
+public:
+    AsyncScreenManager(ScreenManager &&screen, size_t capacity, QueueFullPolicy policy)
+            : metrics(screen.get_transport_metrics()) {
+        state->policy = policy;
+        worker = std::make_unique<DisplayWorker>(std::move(screen), capacity, policy,
+                                                 [weak = std::weak_ptr<State>(state)] {
+            py::gil_scoped_acquire gil;
+            const auto locked = weak.lock();
+            if (!locked || locked->loop.is_none()) return;
+            try {
+                locked->loop.attr("call_soon_threadsafe")(py::cpp_function([weak] {
+                    if (const auto state = weak.lock()) drain(*state);
+                }));
+            } catch (py::error_already_set &e) {
+                log(LogLevel::Warning, "Couldn't hand display completions to the event loop: {}", e.what());
+            }
+        });
+        state->worker = worker.get();
+    }
+    AsyncScreenManager(const AsyncScreenManager &) = delete;
+    AsyncScreenManager &operator=(const AsyncScreenManager &) = delete;
+
+    ~AsyncScreenManager() {
+        state->worker = nullptr;
+        {
+            // The worker may need the GIL to report its last completions
+            py::gil_scoped_release release;
+            worker.reset();
+        }
+        auto pending = std::move(state->futures);
+        auto waiting = std::move(state->waiting);
+        try {
+            for (auto &[id, future]: pending) future.attr("cancel")();
+            for (auto &[job, future]: waiting) future.attr("cancel")();
+        } catch (py::error_already_set &e) {
+            log(LogLevel::Warning, "Couldn't cancel pending display futures: {}", e.what());
+        }
+    }
+
+    py::object submit(DisplayWorker::Job job) {
+        const auto loop = py::module_::import("asyncio").attr("get_running_loop")();
+        if (state->loop.is_none()) {
+            state->loop = loop;
+        } else if (!state->loop.is(loop)) {
+            throw py::value_error("AsyncScreenManager is already used from another event loop");
+        }
+        auto future = loop.attr("create_future")();
+        future.attr("add_done_callback")(py::cpp_function([weak = std::weak_ptr<State>(state)](py::object done) {
+            if (const auto state = weak.lock()) on_done(*state, done);
+        }));
+        // Waiting jobs keep their order, nothing jumps the queue
+        const auto id = state->waiting.empty() ? worker->submit(job) : std::nullopt;
+        if (id) {
+            track(*state, *id, future);
+        } else if (state->policy == QueueFullPolicy::Wait && state->waiting.size() < worker->get_capacity()) {
+            state->waiting.emplace_back(std::move(job), future);
+        } else {
+            future.attr("set_exception")(py::reinterpret_borrow<py::object>(PyExc_RuntimeError)("Display queue is full"));
+        }
+        return future;
+    }
+
+    [[nodiscard]] size_t queued() const { return worker->queued() + state->waiting.size(); }
+    [[nodiscard]] size_t capacity() const { return worker->get_capacity(); }
+    // Only atomics behind this, so it's read without going through the worker
+    [[nodiscard]] const std::shared_ptr<TransportMetrics> &transport_metrics() const { return metrics; }
+};
+
+AsyncScreenManager *create_async_screenmanager(const char *path, double vcom, size_t max_queued,
+                                               QueueFullPolicy policy) {
+    return new AsyncScreenManager(create_screenmanager(path, vcom), max_queued, policy);
+}
+
+// Jobs run later on the worker, so arrays are copied rather than borrowed
+template<auto Method>
+py::object submit_buffer_region(AsyncScreenManager &self, const py::buffer &array, uint32_t x, uint32_t y,
+                                WaveMode wavemode) {
+    auto img = mat_from_buffer(array.request()).clone();
+    return self.submit([img = std::move(img), x, y, wavemode](ScreenManager &screen) {
+        return (screen.*Method)(img, x, y, wavemode);
+    });
+}
+
+// None for panels whose job failed or was cancelled
+std::vector<std::optional<DisplayStats>> panel_stats(const std::vector<DisplayJobResult> &results) {
+    std::vector<std::optional<DisplayStats>> stats;
+    for (const auto &result: results) {
+        stats.push_back(result.status == DisplayJobResult::Status::Done ? std::optional(result.stats) : std::nullopt);
+    }
+    return stats;
+}
+
+/**
+ * Owns a FrameStream for Python. A Python frame source runs on the decode thread and
+ * takes the GIL for every frame, so the stream is stopped and joined without it.
+ */
+class PyFrameStream {
+    std::unique_ptr<FrameStream> stream;
+
+public:
+    explicit PyFrameStream(std::unique_ptr<FrameStream> stream) : stream(std::move(stream)) {}
+    PyFrameStream(const PyFrameStream &) = delete;
+    ~PyFrameStream() {
+        py::gil_scoped_release release;
+        stream.reset();
+    }
+
+    FrameStream &get() { return *stream; }
+};
+
+// Calls source for every frame, it returns a 2-D uint8 array or None at the end
+FrameStream::FrameSource python_frame_source(py::function source) {
+    // Copies of the std::function share the callable, it's only touched with the GIL held
+    const auto function = std::shared_ptr<py::function>(new py::function(std::move(source)), [](py::function *f) {
+        py::gil_scoped_acquire acquire;
+        delete f;
+    });
+    return [function](Mat &frame) {
+        py::gil_scoped_acquire acquire;
+        try {
+            const auto result = (*function)();
+            if (result.is_none()) return false;
+            mat_from_buffer(result.cast<py::buffer>().request()).copyTo(frame);
+            return true;
+        } catch (const py::error_already_set &e) {
+            log(LogLevel::Error, "Frame source failed: {}", e.what());
+            return false;
+        }
+    };
+}
+
 PYBIND11_MODULE(IT8951, m) {
+    py::enum_<PixelFormat>(m, "PixelFormat")
+            .value("Bpp1", PixelFormat::Bpp1)
+            .value("Bpp2", PixelFormat::Bpp2)
+            .value("Bpp4", PixelFormat::Bpp4)
+            .value("Bpp8", PixelFormat::Bpp8);
+    py::enum_<DitherMode>(m, "DitherMode")
+            .value("None", DitherMode::None)
+            .value("Bayer", DitherMode::Bayer)
+            .value("BlueNoise", DitherMode::BlueNoise)
+            .value("FloydSteinberg", DitherMode::FloydSteinberg)
+            .value("Atkinson", DitherMode::Atkinson);
+
+    py::enum_<WaveMode>(m, "WaveMode")
+            .value("Init", WaveMode::Init)
+            .value("DU", WaveMode::DU)
+            .value("GC16", WaveMode::GC16)
+            .value("GL16", WaveMode::GL16)
+            .value("GLR16", WaveMode::GLR16)
+            .value("GLD16", WaveMode::GLD16)
+            .value("DU4", WaveMode::DU4)
+            .value("A2", WaveMode::A2);
+
+    py::class_<RefreshPolicy>(m, "RefreshPolicy")
+            .def(py::init<>())
+            .def_readwrite("latency_budget", &RefreshPolicy::latency_budget)
+            .def_readwrite("full_refresh_interval", &RefreshPolicy::full_refresh_interval)
+            .def_readwrite("merge_distance", &RefreshPolicy::merge_distance);
+
+    py::class_<DisplayStats>(m, "DisplayStats")
+            .def_readonly("bytes_sent", &DisplayStats::bytes_sent)
+            .def_readonly("bytes_skipped", &DisplayStats::bytes_skipped)
+            .def_readonly("area_updated", &DisplayStats::area_updated)
+            .def_readonly("area_skipped", &DisplayStats::area_skipped)
+            .def_readonly("regions", &DisplayStats::regions);
+
+    py::class_<FrameCacheStats>(m, "FrameCacheStats")
+            .def_readonly("hits", &FrameCacheStats::hits)
+            .def_readonly("misses", &FrameCacheStats::misses)
+            .def_readonly("evictions", &FrameCacheStats::evictions)
+            .def_readonly("bytes", &FrameCacheStats::bytes)
+            .def_readonly("entries", &FrameCacheStats::entries);
+
+    py::class_<ResidentImageCacheStats>(m, "ResidentImageCacheStats")
+            .def_readonly("hits", &ResidentImageCacheStats::hits)
+            .def_readonly("misses", &ResidentImageCacheStats::misses)
+            .def_readonly("evictions", &ResidentImageCacheStats::evictions)
+            .def_readonly("resident", &ResidentImageCacheStats::resident)
+            .def_readonly("slots", &ResidentImageCacheStats::slots);
+
+    py::enum_<UploadEngine>(m, "UploadEngine")
+            .value("LoadImageArea", UploadEngine::LoadImageArea)
+            .value("FastWriteMemory", UploadEngine::FastWriteMemory);
+
+    py::enum_<TransportCommand>(m, "TransportCommand")
+            .value("ReadRegister", TransportCommand::ReadRegister)
+            .value("WriteRegister", TransportCommand::WriteRegister)
+            .value("LoadImage", TransportCommand::LoadImage)
+            .value("Display", TransportCommand::Display)
+            .value("Pmic", TransportCommand::Pmic)
+            .value("ReadMemory", TransportCommand::ReadMemory)
+            .value("WriteMemory", TransportCommand::WriteMemory)
+            .value("FastWriteMemory", TransportCommand::FastWriteMemory)
+            .value("Other", TransportCommand::Other);
+
+    py::class_<CommandMetrics>(m, "CommandMetrics")
+            .def_readonly("commands", &CommandMetrics::commands)
+            .def_readonly("failed", &CommandMetrics::failed)
+            .def_readonly("status_errors", &CommandMetrics::status_errors)
+            .def_readonly("host_errors", &CommandMetrics::host_errors)
+            .def_readonly("driver_errors", &CommandMetrics::driver_errors)
+            .def_readonly("short_transfers", &CommandMetrics::short_transfers)
+            .def_readonly("bytes", &CommandMetrics::bytes)
+            .def_readonly("total_latency", &CommandMetrics::total_latency)
+            .def_readonly("max_latency", &CommandMetrics::max_latency)
+            .def_readonly("latency_histogram", &CommandMetrics::latency_histogram)
+            .def("latency_percentile", &CommandMetrics::latency_percentile, py::arg("fraction"));
+
+    // Counters keep running while snapshots are taken, reset() starts them over
+    py::class_<TransportMetrics, std::shared_ptr<TransportMetrics>>(m, "TransportMetrics")
+            .def("snapshot", [](const TransportMetrics &self) {
+                const auto snapshot = self.snapshot();
+                std::map<TransportCommand, CommandMetrics> commands;
+                for (size_t i = 0; i < transport_command_count; i++) {
+                    commands.emplace(static_cast<TransportCommand>(i), snapshot.commands[i]);
+                }
+                return commands;
+            })
+            .def("reset", &TransportMetrics::reset)
+            .def_property_readonly_static("latency_bucket_bounds", [](const py::object &) {
+                std::vector<std::chrono::microseconds> bounds;
+                for (size_t bucket = 0; bucket + 1 < latency_bucket_count; bucket++) {
+                    bounds.push_back(latency_bucket_bound(bucket));
+                }
+                return bounds;
+            });
+
     //ScreenManager
     py::class_<ScreenManager>(m, "ScreenManager")
-            .def("display", &ScreenManager::display)
+            .def("display", py::overload_cast<const std::filesystem::path &>(&ScreenManager::display),
+                 py::arg("path"), py::call_guard<py::gil_scoped_release>())
+            .def("display_array", [](ScreenManager &self, const py::buffer &array) {
+                     const auto buffer = array.request();
+                     const auto img = mat_from_buffer(buffer);
+                     py::gil_scoped_release release;
+                     return self.display(img);
+                 }, py::arg("array"))
+            .def("display_region", &display_buffer_region<&ScreenManager::display_region>, py::arg("array"),
+                 py::arg("x"), py::arg("y"), py::arg("wavemode") = WaveMode::GC16)
+            .def("update_region", &display_buffer_region<&ScreenManager::update_region>, py::arg("array"),
+                 py::arg("x"), py::arg("y"), py::arg("wavemode") = WaveMode::GC16)
+            .def("flush", &ScreenManager::flush, py::call_guard<py::gil_scoped_release>())
+            .def("flush_if_due", &ScreenManager::flush_if_due, py::call_guard<py::gil_scoped_release>())
+            .def("set_refresh_policy", &ScreenManager::set_refresh_policy, py::arg("policy"))
             .def("clear_screen", &ScreenManager::clear_screen)
+            .def("wait_until_ready", &ScreenManager::wait_until_ready,
+                 py::call_guard<py::gil_scoped_release>())
             .def("set_vcom", &ScreenManager::set_vcom)
-            .def("set_rotation", &ScreenManager::set_rotation);
+            .def("set_rotation", &ScreenManager::set_rotation)
+            .def("set_pixel_format", &ScreenManager::set_pixel_format, py::arg("format"))
+            .def("set_tone_map", &ScreenManager::set_tone_map, py::arg("tone_map"))
+            .def("set_dither_mode", &ScreenManager::set_dither_mode, py::arg("mode"))
+            .def("set_frame_cache_size", &ScreenManager::set_frame_cache_size, py::arg("bytes"))
+            .def("frame_cache_stats", &ScreenManager::frame_cache_stats)
+            .def("invalidate_frame_cache", &ScreenManager::invalidate_frame_cache, py::arg("path") = "")
+            .def("set_resident_image_slots", &ScreenManager::set_resident_image_slots, py::arg("slots"))
+            .def("resident_image_stats", &ScreenManager::resident_image_stats)
+            .def("set_auto_waveform", &ScreenManager::set_auto_waveform, py::arg("enabled"))
+            .def("autotune_transfer_size", &ScreenManager::autotune_transfer_size,
+                 py::arg("cache_file") = "")
+            .def("set_max_in_flight", &ScreenManager::set_max_in_flight, py::arg("requests"))
+            .def("set_upload_engine", &ScreenManager::set_upload_engine, py::arg("engine"))
+            .def_property_readonly("transport_metrics", &ScreenManager::get_transport_metrics)
+            .def("set_image_buffer_layout_confirmed", &ScreenManager::set_image_buffer_layout_confirmed,
+                 py::arg("confirmed"))
+            .def("set_image_buffer_count", &ScreenManager::set_image_buffer_count, py::arg("count"));
 
     m.def("create_screenmanager", &create_screenmanager, py::arg("path"), py::arg("vcom"),
           py::return_value_policy::move);
 
+    py::enum_<QueueFullPolicy>(m, "QueueFullPolicy")
+            .value("Wait", QueueFullPolicy::Wait)
+            .value("ReplaceOldest", QueueFullPolicy::ReplaceOldest)
+            .value("Reject", QueueFullPolicy::Reject);
+
+    // Every method has to be called from a running event loop and returns a future
+    py::class_<AsyncScreenManager>(m, "AsyncScreenManager")
+            .def("display", [](AsyncScreenManager &self, const std::filesystem::path &path) {
+                return self.submit([path](ScreenManager &screen) { return screen.display(path); });
+            }, py::arg("path"))
+            .def("display_array", [](AsyncScreenManager &self, const py::buffer &array) {
+                auto img = mat_from_buffer(array.request()).clone();
+                return self.submit([img = std::move(img)](ScreenManager &screen) { return screen.display(img); });
+            }, py::arg("array"))
+            .def("display_region", &submit_buffer_region<&ScreenManager::display_region>, py::arg("array"),
+                 py::arg("x"), py::arg("y"), py::arg("wavemode") = WaveMode::GC16)
+            .def("update_region", &submit_buffer_region<&ScreenManager::update_region>, py::arg("array"),
+                 py::arg("x"), py::arg("y"), py::arg("wavemode") = WaveMode::GC16)
+            .def("flush", [](AsyncScreenManager &self) {
+                return self.submit([](ScreenManager &screen) { return screen.flush(); });
+            })
+            .def("clear_screen", [](AsyncScreenManager &self) {
+                return self.submit([](ScreenManager &screen) {
+                    screen.clear_screen();
+                    return DisplayStats{};
+                });
+            })
+            .def("set_rotation", [](AsyncScreenManager &self, int rotation) {
+                return self.submit([rotation](ScreenManager &screen) {
+                    screen.set_rotation(rotation);
+                    return DisplayStats{};
+                });
+            }, py::arg("rotation"))
+            .def("set_pixel_format", [](AsyncScreenManager &self, PixelFormat format) {
+                return self.submit([format](ScreenManager &screen) {
+                    screen.set_pixel_format(format);
+                    return DisplayStats{};
+                });
+            }, py::arg("format"))
+            .def("set_dither_mode", [](AsyncScreenManager &self, DitherMode mode) {
+                return self.submit([mode](ScreenManager &screen) {
+                    screen.set_dither_mode(mode);
+                    return DisplayStats{};
+                });
+            }, py::arg("mode"))
+            .def_property_readonly("queued", &AsyncScreenManager::queued)
+            .def_property_readonly("capacity", &AsyncScreenManager::capacity)
+            .def_property_readonly("transport_metrics", &AsyncScreenManager::transport_metrics);
+
+    py::class_<PanelInfo>(m, "PanelInfo")
+            .def_readonly("path", &PanelInfo::path)
+            .def_property_readonly("width", [](const PanelInfo &panel) { return panel.info.uiWidth; })
+            .def_property_readonly("height", [](const PanelInfo &panel) { return panel.info.uiHeight; });
+
+    m.def("discover_panels", [] { return discover_panels(); }, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<MultiPanelManager>(m, "MultiPanelManager")
+            .def("__len__", &MultiPanelManager::size)
+            .def("display", [](MultiPanelManager &self, const std::filesystem::path &path) {
+                return panel_stats(self.display(path));
+            }, py::arg("path"), py::call_guard<py::gil_scoped_release>())
+            .def("display_each", [](MultiPanelManager &self, const std::vector<std::filesystem::path> &paths) {
+                return panel_stats(self.display(paths));
+            }, py::arg("paths"), py::call_guard<py::gil_scoped_release>())
+            .def("display_tiled", [](MultiPanelManager &self, const py::buffer &array, uint32_t columns) {
+                const auto buffer = array.request();
+                const auto frame = mat_from_buffer(buffer);
+                py::gil_scoped_release release;
+                return panel_stats(self.display_tiled(frame, columns));
+            }, py::arg("array"), py::arg("columns"));
+
+    m.def("create_multipanel_manager", [](const std::vector<std::string> &paths, size_t max_queued) {
+        return new MultiPanelManager(MultiPanelManager::open(paths, max_queued));
+    }, py::arg("paths"), py::arg("max_queued") = 2, py::call_guard<py::gil_scoped_release>(),
+          py::return_value_policy::take_ownership);
+
+    m.def("create_async_screenmanager", &create_async_screenmanager, py::arg("path"), py::arg("vcom"),
+          py::arg("max_queued") = 2, py::arg("policy") = QueueFullPolicy::Wait,
+          py::return_value_policy::take_ownership);
+
+    py::enum_<StreamStage>(m, "StreamStage")
+            .value("Decode", StreamStage::Decode)
+            .value("Render", StreamStage::Render)
+            .value("Dither", StreamStage::Dither)
+            .value("Upload", StreamStage::Upload);
+
+    py::class_<StreamOptions>(m, "StreamOptions")
+            .def(py::init<>())
+            .def_readwrite("wavemode", &StreamOptions::wavemode)
+            .def_readwrite("format", &StreamOptions::format)
+            .def_readwrite("dither", &StreamOptions::dither)
+            .def_readwrite("realtime", &StreamOptions::realtime)
+            .def_readwrite("latest_frame_wins", &StreamOptions::latest_frame_wins);
+
+    py::class_<StreamStageStats>(m, "StreamStageStats")
+            .def_readonly("frames", &StreamStageStats::frames)
+            .def_readonly("dropped", &StreamStageStats::dropped)
+            .def_readonly("occupancy", &StreamStageStats::occupancy);
+
+    py::class_<StreamStats>(m, "StreamStats")
+            .def_readonly("frames_shown", &StreamStats::frames_shown)
+            .def_readonly("fps", &StreamStats::fps)
+            .def_readonly("elapsed", &StreamStats::elapsed)
+            .def_readonly("mean_latency", &StreamStats::mean_latency)
+            .def_readonly("max_latency", &StreamStats::max_latency)
+            .def_property_readonly("stages", [](const StreamStats &self) {
+                std::map<StreamStage, StreamStageStats> stages;
+                for (size_t i = 0; i < stream_stage_count; i++) {
+                    stages.emplace(static_cast<StreamStage>(i), self.stages[i]);
+                }
+                return stages;
+            });
+
+    py::class_<PyFrameStream>(m, "FrameStream")
+            .def("stop", [](PyFrameStream &self) { self.get().stop(); })
+            .def("wait", [](PyFrameStream &self) { self.get().wait(); }, py::call_guard<py::gil_scoped_release>())
+            .def_property_readonly("running", [](PyFrameStream &self) { return self.get().running(); })
+            .def("stats", [](PyFrameStream &self) { return self.get().stats(); });
+
+    m.def("create_video_stream", [](const char *path, double vcom, const std::filesystem::path &video,
+                                    const StreamOptions &options) {
+        return new PyFrameStream(std::make_unique<FrameStream>(create_screenmanager(path, vcom), video, options));
+    }, py::arg("path"), py::arg("vcom"), py::arg("video"), py::arg("options") = StreamOptions{},
+          py::return_value_policy::take_ownership);
+
+    m.def("create_frame_stream", [](const char *path, double vcom, py::function source,
+                                    const StreamOptions &options) {
+        return new PyFrameStream(std::make_unique<FrameStream>(create_screenmanager(path, vcom),
+                                                               python_frame_source(std::move(source)), options));
+    }, py::arg("path"), py::arg("vcom"), py::arg("source"), py::arg("options") = StreamOptions{},
+          py::return_value_policy::take_ownership);
+
     //Logging
     py::enum_<LogLevel>(m, "LogLevel")
             .value("Debug", LogLevel::Debug)
@@ -36,6 +529,15 @@ PYBIND11_MODULE(IT8951, m) {
 
     m.def("setLogLevel",[](LogLevel logLevel){maxLogLevel=logLevel;}, py::arg("logLevel"));
 
+    py::enum_<LogOverflowPolicy>(m, "LogOverflowPolicy")
+            .value("Drop", LogOverflowPolicy::Drop)
+            .value("Block", LogOverflowPolicy::Block);
+
+    m.def("set_async_logging", &set_async_logging, py::arg("enabled"));
+    m.def("set_log_overflow_policy", &set_log_overflow_policy, py::arg("policy"));
+    m.def("dropped_log_messages", &dropped_log_messages);
+    m.def("flush_log", &flush_log, py::call_guard<py::gil_scoped_release>());
+
 //    m.attr("maxLogLevel") = py::cast(maxLogLevel, pybind11::return_value_policy::reference);
 }
 
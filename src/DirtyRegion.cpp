@@ -0,0 +1,101 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "DirtyRegion.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+struct OpenRun {
+  uint32_t first_tile;
+  uint32_t last_tile;  // exclusive
+  uint32_t first_row;
+  bool     extended;
+};
+
+IT8951Area run_to_area(const OpenRun& run, uint32_t end_row, uint32_t tile_size,
+                       uint32_t width, uint32_t height) {
+  const uint32_t x = run.first_tile * tile_size;
+  const uint32_t y = run.first_row * tile_size;
+  return {.x = x,
+          .y = y,
+          .w = std::min(run.last_tile * tile_size, width) - x,
+          .h = std::min(end_row * tile_size, height) - y};
+}
+}  // namespace
+
+std::pmr::vector<IT8951Area> find_dirty_areas(const cv::Mat& previous, const cv::Mat& next,
+                                              uint32_t tile_size, size_t max_regions,
+                                              std::pmr::memory_resource* memory) {
+  assert(previous.size() == next.size());
+  assert(previous.elemSize() == 1 && next.elemSize() == 1);
+  const auto width   = static_cast<uint32_t>(next.cols);
+  const auto height  = static_cast<uint32_t>(next.rows);
+  const auto tiles_x = (width + tile_size - 1) / tile_size;
+  const auto tiles_y = (height + tile_size - 1) / tile_size;
+
+  std::pmr::vector<IT8951Area> areas(memory);
+  std::pmr::vector<OpenRun>    open_runs(memory);
+  std::pmr::vector<OpenRun>    new_runs(memory);
+  std::pmr::vector<uint8_t>    dirty(tiles_x, memory);
+
+  for (uint32_t ty = 0; ty < tiles_y; ty++) {
+    std::fill(dirty.begin(), dirty.end(), 0);
+    const uint32_t row_end = std::min((ty + 1) * tile_size, height);
+    for (uint32_t y = ty * tile_size; y < row_end; y++) {
+      const auto* prev_row = previous.ptr<uint8_t>(static_cast<int>(y));
+      const auto* next_row = next.ptr<uint8_t>(static_cast<int>(y));
+      for (uint32_t tx = 0; tx < tiles_x; tx++) {
+        if (dirty[tx]) continue;
+        const uint32_t x = tx * tile_size;
+        const uint32_t n = std::min(tile_size, width - x);
+        dirty[tx] = std::memcmp(prev_row + x, next_row + x, n) != 0;
+      }
+    }
+
+    // Horizontal runs of dirty tiles either extend a run with the same span from
+    // the previous tile row or start a new one.
+    for (auto& run : open_runs) run.extended = false;
+    new_runs.clear();
+    for (uint32_t tx = 0; tx < tiles_x;) {
+      if (!dirty[tx]) {
+        tx++;
+        continue;
+      }
+      uint32_t end = tx;
+      while (end < tiles_x && dirty[end]) end++;
+      auto existing = std::find_if(open_runs.begin(), open_runs.end(), [&](const OpenRun& r) {
+        return r.first_tile == tx && r.last_tile == end;
+      });
+      if (existing != open_runs.end()) {
+        existing->extended = true;
+      } else {
+        new_runs.push_back({.first_tile = tx, .last_tile = end, .first_row = ty, .extended = true});
+      }
+      tx = end;
+    }
+    std::erase_if(open_runs, [&](const OpenRun& run) {
+      if (run.extended) return false;
+      areas.push_back(run_to_area(run, ty, tile_size, width, height));
+      return true;
+    });
+    open_runs.insert(open_runs.end(), new_runs.begin(), new_runs.end());
+  }
+  for (const auto& run : open_runs) {
+    areas.push_back(run_to_area(run, tiles_y, tile_size, width, height));
+  }
+
+  if (areas.size() > max_regions) {
+    uint32_t x0 = width, y0 = height, x1 = 0, y1 = 0;
+    for (const auto& a : areas) {
+      x0 = std::min(x0, a.x);
+      y0 = std::min(y0, a.y);
+      x1 = std::max(x1, a.x + a.w);
+      y1 = std::max(y1, a.y + a.h);
+    }
+    areas = {{.x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0}};
+  }
+  return areas;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "DisplayWorker.hpp"
+#include <algorithm>
+#include <exception>
+#include "log.hpp"
+
+DisplayWorker::DisplayWorker(ScreenManager&& screen, size_t capacity, QueueFullPolicy policy,
+                             std::function<void()> notify)
+    : screen(std::move(screen)),
+      capacity(std::max<size_t>(capacity, 1)),
+      policy(policy),
+      notify(std::move(notify)),
+      worker(&DisplayWorker::run_worker, this) {}
+
+DisplayWorker::~DisplayWorker() {
+  std::deque<QueuedJob> cancelled;
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+    cancelled.swap(jobs);
+  }
+  jobs_changed.notify_all();
+  worker.join();
+  for (const auto& job : cancelled) complete({.id = job.id, .status = DisplayJobResult::Status::Cancelled});
+}
+
+std::optional<uint64_t> DisplayWorker::submit(Job job) {
+  std::optional<QueuedJob> replaced;
+  uint64_t                 id;
+  {
+    std::lock_guard lock(mutex);
+    if (jobs.size() >= capacity) {
+      if (policy != QueueFullPolicy::ReplaceOldest) return std::nullopt;
+      replaced = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    id = next_id++;
+    jobs.push_back({id, std::move(job)});
+  }
+  jobs_changed.notify_one();
+  if (replaced) {
+    log(LogLevel::Debug, "Display queue full, replacing job {}", replaced->id);
+    complete({.id = replaced->id, .status = DisplayJobResult::Status::Cancelled});
+  }
+  return id;
+}
+
+bool DisplayWorker::cancel(uint64_t id) {
+  {
+    std::lock_guard lock(mutex);
+    const auto      job = std::find_if(jobs.begin(), jobs.end(), [id](const auto& job) { return job.id == id; });
+    if (job == jobs.end()) return false;
+    jobs.erase(job);
+  }
+  complete({.id = id, .status = DisplayJobResult::Status::Cancelled});
+  return true;
+}
+
+std::vector<DisplayJobResult> DisplayWorker::take_completions() {
+  std::lock_guard lock(mutex);
+  return std::exchange(completions, {});
+}
+
+size_t DisplayWorker::queued() const {
+  std::lock_guard lock(mutex);
+  return jobs.size();
+}
+
+void DisplayWorker::complete(DisplayJobResult result) {
+  {
+    std::lock_guard lock(mutex);
+    completions.push_back(std::move(result));
+  }
+  if (notify) notify();
+}
+
+void DisplayWorker::run_worker() {
+  for (;;) {
+    std::unique_lock lock(mutex);
+    // Regions queued by update_region are flushed once they're due, even if no job follows
+    if (const auto due = screen.next_flush_due()) {
+      if (!jobs_changed.wait_until(lock, *due, [this] { return stopping || !jobs.empty(); })) {
+        lock.unlock();
+        try {
+          screen.flush_if_due();
+        } catch (const std::exception& e) {
+          log(LogLevel::Error, "Flushing queued regions failed: {}", e.what());
+        }
+        continue;
+      }
+    } else {
+      jobs_changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+    }
+    if (stopping) return;
+    auto job = std::move(jobs.front());
+    jobs.pop_front();
+    lock.unlock();
+
+    DisplayJobResult result{.id = job.id, .status = DisplayJobResult::Status::Done};
+    try {
+      result.stats = job.job(screen);
+    } catch (const std::exception& e) {
+      log(LogLevel::Error, "Display job {} failed: {}", job.id, e.what());
+      result.status = DisplayJobResult::Status::Failed;
+      result.error  = e.what();
+    }
+    complete(std::move(result));
+  }
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "Dither.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <memory_resource>
+#include <random>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+// Threshold rows are repeated up to a multiple of the 16 pixel SIMD width
+struct ThresholdMap {
+  uint32_t              size;
+  uint32_t              period;
+  std::vector<uint16_t> thresholds;  // size rows of period entries, each in 0-254
+
+  const uint16_t* row(uint32_t y) const { return thresholds.data() + (y % size) * period; }
+};
+
+ThresholdMap make_threshold_map(const std::vector<uint32_t>& ranks, uint32_t size) {
+  ThresholdMap map{size, std::max<uint32_t>(size, 16), {}};
+  map.thresholds.resize(static_cast<size_t>(map.size) * map.period);
+  const auto count = static_cast<uint64_t>(size) * size;
+  for (uint32_t y = 0; y < size; y++) {
+    for (uint32_t x = 0; x < map.period; x++) {
+      // Centered in the rank's bucket so the average level isn't biased
+      const auto rank = ranks[y * size + x % size];
+      map.thresholds[y * map.period + x] = static_cast<uint16_t>((2 * rank + 1) * 255 / (2 * count));
+    }
+  }
+  return map;
+}
+
+const ThresholdMap& bayer_map() {
+  static const ThresholdMap map = [] {
+    constexpr uint32_t size = 8;
+    std::vector<uint32_t> ranks(size * size);
+    for (uint32_t y = 0; y < size; y++) {
+      for (uint32_t x = 0; x < size; x++) {
+        uint32_t rank = 0;
+        for (uint32_t bit = 0; bit < 3; bit++) {
+          rank = (rank << 2) | (((x ^ y) >> bit & 1) << 1) | (y >> bit & 1);
+        }
+        ranks[y * size + x] = rank;
+      }
+    }
+    return make_threshold_map(ranks, size);
+  }();
+  return map;
+}
+
+// Void-and-cluster, computed once on first use. The tightest cluster of zeros is the
+// largest void of ones since both energies add up to the kernel sum, so phase three
+// is the same loop as phase two.
+const ThresholdMap& blue_noise_map() {
+  static const ThresholdMap map = [] {
+    constexpr uint32_t size  = 64;
+    constexpr uint32_t count = size * size;
+    constexpr float    sigma = 1.5f;
+    std::vector<float> kernel(count);
+    for (uint32_t y = 0; y < size; y++) {
+      for (uint32_t x = 0; x < size; x++) {
+        const auto dx = static_cast<float>(std::min(x, size - x));
+        const auto dy = static_cast<float>(std::min(y, size - y));
+        kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+      }
+    }
+    std::vector<uint8_t> pattern(count);
+    std::vector<float>   energy(count);
+    const auto toggle = [&](uint32_t p, bool on) {
+      pattern[p]       = on;
+      const float sign = on ? 1.f : -1.f;
+      const auto  px = p % size, py = p / size;
+      for (uint32_t q = 0; q < count; q++) {
+        energy[q] += sign * kernel[((q / size - py) & (size - 1)) * size + ((q % size - px) & (size - 1))];
+      }
+    };
+    const auto tightest_cluster = [&] {
+      uint32_t best = 0;
+      float    most = -1;
+      for (uint32_t p = 0; p < count; p++) {
+        if (pattern[p] && energy[p] > most) most = energy[p], best = p;
+      }
+      return best;
+    };
+    const auto largest_void = [&] {
+      uint32_t best  = 0;
+      float    least = std::numeric_limits<float>::max();
+      for (uint32_t p = 0; p < count; p++) {
+        if (!pattern[p] && energy[p] < least) least = energy[p], best = p;
+      }
+      return best;
+    };
+
+    std::mt19937 random(1);
+    for (uint32_t placed = 0; placed < count / 10;) {
+      const auto p = random() % count;
+      if (!pattern[p]) toggle(p, true), placed++;
+    }
+    // Spread the initial pattern evenly
+    for (;;) {
+      const auto cluster = tightest_cluster();
+      toggle(cluster, false);
+      const auto gap = largest_void();
+      toggle(gap, true);
+      if (gap == cluster) break;
+    }
+
+    std::vector<uint32_t> ranks(count);
+    const auto            initial_pattern = pattern;
+    const auto            initial_energy  = energy;
+    const auto            ones            = static_cast<uint32_t>(std::count(pattern.begin(), pattern.end(), 1));
+    for (auto rank = ones; rank-- > 0;) {
+      const auto cluster = tightest_cluster();
+      toggle(cluster, false);
+      ranks[cluster] = rank;
+    }
+    pattern = initial_pattern;
+    energy  = initial_energy;
+    for (auto rank = ones; rank < count; rank++) {
+      const auto gap = largest_void();
+      toggle(gap, true);
+      ranks[gap] = rank;
+    }
+    return make_threshold_map(ranks, size);
+  }();
+  return map;
+}
+
+// level = floor((v * max_level + threshold) / 255), then spread back over 0-255
+void threshold_row(uint8_t* row, uint32_t width, const uint16_t* thresholds, uint32_t period,
+                   uint16_t max_level) {
+  const auto step = static_cast<uint16_t>(255 / max_level);
+  uint32_t   x    = 0;
+#if defined(__SSE2__)
+  const auto zero  = _mm_setzero_si128();
+  const auto one   = _mm_set1_epi16(1);
+  const auto level = _mm_set1_epi16(static_cast<short>(max_level));
+  const auto steps = _mm_set1_epi16(static_cast<short>(step));
+  // (v + 1 + (v >> 8)) >> 8 divides by 255 exactly for every v that fits 16 bits unsigned
+  const auto quantize = [&](__m128i pixels, const uint16_t* threshold) {
+    const auto t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(threshold));
+    const auto v = _mm_add_epi16(_mm_mullo_epi16(pixels, level), t);
+    const auto q = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, one), _mm_srli_epi16(v, 8)), 8);
+    return _mm_mullo_epi16(q, steps);
+  };
+  for (; x + 16 <= width; x += 16) {
+    const auto  pixels    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+    const auto* threshold = thresholds + x % period;
+    const auto  low       = quantize(_mm_unpacklo_epi8(pixels, zero), threshold);
+    const auto  high      = quantize(_mm_unpackhi_epi8(pixels, zero), threshold + 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm_packus_epi16(low, high));
+  }
+#endif
+  for (; x < width; x++) {
+    const uint32_t v = row[x] * max_level + thresholds[x % period];
+    row[x]           = static_cast<uint8_t>(((v + 1 + (v >> 8)) >> 8) * step);
+  }
+}
+
+struct FloydSteinberg {
+  static constexpr int shift = 4;
+  static constexpr int right = 7, right2 = 0;
+  static constexpr int below_left = 3, below = 5, below_right = 1, below2 = 0;
+};
+
+struct Atkinson {
+  // Only 6/8 of the error is passed on, which keeps highlights and shadows clean
+  static constexpr int shift = 3;
+  static constexpr int right = 1, right2 = 1;
+  static constexpr int below_left = 1, below = 1, below_right = 1, below2 = 1;
+};
+
+// Pixel x reads and writes error cells the row above touches up to its pixel x + 1
+constexpr uint32_t wavefront_lag = 2;
+// How often a row publishes its progress to the row below
+constexpr uint32_t progress_interval = 64;
+
+// Pixels done in a row, kept on separate cache lines since neighbouring rows run on other threads
+struct alignas(64) RowProgress {
+  std::atomic<uint32_t> done{0};
+};
+
+/**
+ * Error rows are one pixel wider on both sides and hold undivided weighted sums.
+ * Errors to the right stay in registers, so the only rows shared between threads are
+ * the ones below, which the wavefront keeps apart.
+ */
+template <typename Kernel>
+void diffuse_rows(cv::Mat& img, uint16_t max_level, std::pmr::vector<int16_t>& errors,
+                  std::pmr::vector<RowProgress>& progress, uint32_t first_row, uint32_t row_step) {
+  const auto width  = static_cast<uint32_t>(img.cols);
+  const auto height = static_cast<uint32_t>(img.rows);
+  const auto stride = static_cast<size_t>(width) + 2;
+  const int  step   = 255 / max_level;
+  for (uint32_t y = first_row; y < height; y += row_step) {
+    uint8_t*       row       = img.ptr<uint8_t>(static_cast<int>(y));
+    const int16_t* incoming  = errors.data() + y * stride;
+    int16_t*       below     = errors.data() + (y + 1) * stride;
+    int16_t*       below2    = errors.data() + (y + 2) * stride;
+    uint32_t       available = y == 0 ? width : 0;
+    int            carry = 0, carry2 = 0;
+    for (uint32_t x = 0; x < width; x++) {
+      if (x % progress_interval == 0) {
+        progress[y].done.store(x, std::memory_order_release);
+        // Progress is only checked here, so the row above has to be ahead of the whole block
+        const auto needed = std::min(x + progress_interval + wavefront_lag, width);
+        while (available < needed) {
+          available = progress[y - 1].done.load(std::memory_order_acquire);
+          if (available < needed) std::this_thread::yield();
+        }
+      }
+      const int error = (incoming[x + 1] + carry + (1 << (Kernel::shift - 1))) >> Kernel::shift;
+      const int value = std::clamp(row[x] + error, 0, 255);
+      const int level = (value * max_level + 127) / 255;
+      const int out   = level * step;
+      row[x]          = static_cast<uint8_t>(out);
+      const int e     = value - out;
+      carry           = carry2 + e * Kernel::right;
+      carry2          = e * Kernel::right2;
+      below[x] += static_cast<int16_t>(e * Kernel::below_left);
+      below[x + 1] += static_cast<int16_t>(e * Kernel::below);
+      below[x + 2] += static_cast<int16_t>(e * Kernel::below_right);
+      if constexpr (Kernel::below2 != 0) below2[x + 1] += static_cast<int16_t>(e * Kernel::below2);
+    }
+    progress[y].done.store(width, std::memory_order_release);
+  }
+}
+
+template <typename Kernel>
+void diffuse(cv::Mat& img, uint16_t max_level, unsigned threads, std::pmr::memory_resource* memory,
+             WorkerPool* pool) {
+  const auto width  = static_cast<uint32_t>(img.cols);
+  const auto height = static_cast<uint32_t>(img.rows);
+  // Two extra rows take the error pushed off the bottom
+  std::pmr::vector<int16_t>     errors((static_cast<size_t>(height) + 2) * (width + 2), memory);
+  std::pmr::vector<RowProgress> progress(height, memory);
+  // Small images aren't worth starting threads for
+  if (threads == 0) threads = pool ? pool->size() + 1 : std::max(std::thread::hardware_concurrency(), 1u);
+  if (pool) threads = std::min(threads, pool->size() + 1);
+  if (static_cast<uint64_t>(width) * height < 256 * 256) threads = 1;
+  threads = std::min(threads, height);
+
+  auto rows = [&](unsigned first_row) {
+    diffuse_rows<Kernel>(img, max_level, errors, progress, first_row, threads);
+  };
+  if (pool) {
+    pool->run(threads, rows);
+    return;
+  }
+  std::pmr::vector<std::thread> workers(memory);
+  for (unsigned t = 1; t < threads; t++) workers.emplace_back(rows, t);
+  rows(0);
+  for (auto& worker : workers) worker.join();
+}
+}  // namespace
+
+void dither(cv::Mat& img, PixelFormat format, DitherMode mode, unsigned threads,
+            std::pmr::memory_resource* memory, WorkerPool* pool) {
+  assert(img.elemSize() == 1);
+  if (img.empty() || mode == DitherMode::None) return;
+  const auto max_level = static_cast<uint16_t>((1u << bits_per_pixel(format)) - 1);
+  switch (mode) {
+    case DitherMode::Bayer:
+    case DitherMode::BlueNoise: {
+      const auto& map = mode == DitherMode::Bayer ? bayer_map() : blue_noise_map();
+      for (int y = 0; y < img.rows; y++) {
+        threshold_row(img.ptr<uint8_t>(y), static_cast<uint32_t>(img.cols), map.row(static_cast<uint32_t>(y)),
+                      map.period, max_level);
+      }
+      break;
+    }
+    case DitherMode::FloydSteinberg: diffuse<FloydSteinberg>(img, max_level, threads, memory, pool); break;
+    case DitherMode::Atkinson: diffuse<Atkinson>(img, max_level, threads, memory, pool); break;
+    case DitherMode::None: break;
+  }
+}
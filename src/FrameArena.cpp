@@ -0,0 +1,44 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "FrameArena.hpp"
+#include "log.hpp"
+
+size_t FrameArena::bytes_for_panel(uint32_t width, uint32_t height) {
+  const auto pixels = static_cast<size_t>(width) * height;
+  // Quantized 8bpp copy and packed 1bpp copy of a full frame, then per row and column
+  // resampling tables and per tile dirty area bookkeeping with room for vector growth
+  const auto frame = pixels + pixels / 8 + (static_cast<size_t>(width) + height) * 64 + pixels / (32 * 32) * 64;
+  // Error diffusion's int16 error rows, one pixel wider on both sides with two extra rows, and
+  // a cache line of progress per row
+  const auto diffusion = 2 * (static_cast<size_t>(width) + 2) * (height + 2) + static_cast<size_t>(height) * 64;
+  return frame + diffusion;
+}
+
+FrameArena::FrameArena(size_t bytes) : size(bytes), buffer(std::make_unique_for_overwrite<std::byte[]>(bytes)) {
+  monotonic.emplace(buffer.get(), size, &overflow);
+}
+
+void FrameArena::leave() {
+  if (--depth > 0) return;
+  monotonic->release();
+  if (overflow.bytes == 0) return;
+  // Monotonic growth overshoots, so this comfortably covers what the frame took
+  size += overflow.bytes;
+  overflow.bytes = 0;
+  grown++;
+  log(LogLevel::Debug, "Frame arena grew to {} bytes", size);
+  monotonic.reset();
+  buffer = std::make_unique_for_overwrite<std::byte[]>(size);
+  monotonic.emplace(buffer.get(), size, &overflow);
+}
+
+void* FrameArena::Overflow::do_allocate(size_t count, size_t alignment) {
+  bytes += count;
+  return std::pmr::new_delete_resource()->allocate(count, alignment);
+}
+
+void FrameArena::Overflow::do_deallocate(void* pointer, size_t count, size_t alignment) {
+  std::pmr::new_delete_resource()->deallocate(pointer, count, alignment);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "FrameCache.hpp"
+#include <functional>
+#include "log.hpp"
+
+std::optional<FrameKey> FrameKey::for_file(const std::filesystem::path& path, int rotation, uint32_t width,
+                                           uint32_t height) {
+  std::error_code error;
+  const auto      modified = std::filesystem::last_write_time(path, error);
+  if (error) return std::nullopt;
+  const auto size = std::filesystem::file_size(path, error);
+  if (error) return std::nullopt;
+  return FrameKey{.path     = path.string(),
+                  .modified = modified.time_since_epoch().count(),
+                  .size     = size,
+                  .rotation = rotation,
+                  .width    = width,
+                  .height   = height};
+}
+
+size_t FrameCache::KeyHash::operator()(const FrameKey& key) const {
+  size_t hash = std::hash<std::string>{}(key.path);
+  for (const auto value : {static_cast<uint64_t>(key.modified), static_cast<uint64_t>(key.size),
+                           static_cast<uint64_t>(key.rotation), static_cast<uint64_t>(key.width) << 32 | key.height}) {
+    hash ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+FrameCache::Frame FrameCache::find(const FrameKey& key) {
+  const auto found = index.find(key);
+  if (found == index.end()) {
+    misses++;
+    return nullptr;
+  }
+  hits++;
+  entries.splice(entries.begin(), entries, found->second);
+  return found->second->second;
+}
+
+FrameCache::Frame FrameCache::insert(const FrameKey& key, std::vector<uint8_t> frame) {
+  auto shared = std::make_shared<const std::vector<uint8_t>>(std::move(frame));
+  if (shared->size() > max_bytes) return shared;
+  if (const auto existing = index.find(key); existing != index.end()) {
+    bytes -= existing->second->second->size();
+    entries.erase(existing->second);
+    index.erase(existing);
+  }
+  evict_until(max_bytes - shared->size());
+  entries.emplace_front(key, shared);
+  index.emplace(key, entries.begin());
+  bytes += shared->size();
+  return shared;
+}
+
+void FrameCache::invalidate(const std::filesystem::path& path) {
+  const auto name = path.string();
+  for (auto entry = entries.begin(); entry != entries.end();) {
+    if (entry->first.path == name) {
+      bytes -= entry->second->size();
+      index.erase(entry->first);
+      entry = entries.erase(entry);
+    } else {
+      ++entry;
+    }
+  }
+}
+
+void FrameCache::clear() {
+  entries.clear();
+  index.clear();
+  bytes = 0;
+}
+
+void FrameCache::set_max_bytes(size_t new_max_bytes) {
+  max_bytes = new_max_bytes;
+  evict_until(max_bytes);
+}
+
+FrameCacheStats FrameCache::stats() const {
+  return {.hits = hits, .misses = misses, .evictions = evictions, .bytes = bytes, .entries = entries.size()};
+}
+
+void FrameCache::evict_until(size_t limit) {
+  while (bytes > limit && !entries.empty()) {
+    const auto& last = entries.back();
+    log(LogLevel::Debug, "Evicting cached frame {}", last.first.path);
+    bytes -= last.second->size();
+    index.erase(last.first);
+    entries.pop_back();
+    evictions++;
+  }
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "FrameStream.hpp"
+#include <algorithm>
+#include <exception>
+#include "log.hpp"
+
+namespace {
+int64_t nanoseconds_since(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+}  // namespace
+
+FrameStream::FrameStream(ScreenManager&& screen, const std::filesystem::path& video, StreamOptions options)
+    : screen(std::move(screen)), options(options) {
+  auto capture = std::make_shared<cv::VideoCapture>(video.string());
+  if (!capture->isOpened()) {
+    log(LogLevel::Error, "Couldn't open video {}", video.string());
+    finished = true;
+    return;
+  }
+  const auto fps = capture->get(cv::CAP_PROP_FPS);
+  if (options.realtime && fps > 0) {
+    frame_period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / fps));
+  }
+  log(LogLevel::Info, "Streaming {} at {:.1f} fps", video.string(), fps);
+  source = [capture](cv::Mat& frame) { return capture->read(frame); };
+  start_stages();
+}
+
+FrameStream::FrameStream(ScreenManager&& screen, FrameSource source, StreamOptions options)
+    : screen(std::move(screen)), options(options), source(std::move(source)) {
+  if (!this->source) {
+    log(LogLevel::Error, "Stream without a frame source");
+    finished = true;
+    return;
+  }
+  start_stages();
+}
+
+FrameStream::~FrameStream() {
+  stop();
+  wait();
+}
+
+void FrameStream::stop() {
+  stopping.store(true, std::memory_order_release);
+  decoded.close();
+  rendered.close();
+  dithered.close();
+}
+
+void FrameStream::wait() {
+  for (auto& thread : threads) {
+    if (thread.joinable()) thread.join();
+  }
+}
+
+StreamStats FrameStream::stats() const {
+  StreamStats stats;
+  const auto  elapsed_ns = finished.load(std::memory_order_acquire) ? end_ns.load(std::memory_order_relaxed)
+                                                                     : nanoseconds_since(start);
+  stats.elapsed      = std::chrono::nanoseconds(elapsed_ns);
+  stats.frames_shown = frames_shown.load(std::memory_order_relaxed);
+  if (elapsed_ns > 0) stats.fps = static_cast<double>(stats.frames_shown) * 1e9 / static_cast<double>(elapsed_ns);
+  if (stats.frames_shown > 0) {
+    stats.mean_latency = std::chrono::nanoseconds(total_latency_ns.load(std::memory_order_relaxed) /
+                                                  static_cast<int64_t>(stats.frames_shown));
+  }
+  stats.max_latency = std::chrono::nanoseconds(max_latency_ns.load(std::memory_order_relaxed));
+  for (size_t i = 0; i < stream_stage_count; i++) {
+    auto& stage   = stats.stages[i];
+    stage.frames  = counters[i].frames.load(std::memory_order_relaxed);
+    stage.dropped = counters[i].dropped.load(std::memory_order_relaxed);
+    if (elapsed_ns > 0) {
+      stage.occupancy = static_cast<double>(counters[i].busy_ns.load(std::memory_order_relaxed)) /
+                        static_cast<double>(elapsed_ns);
+    }
+  }
+  return stats;
+}
+
+void FrameStream::start_stages() {
+  // The upload stage packs to this format, the render and dither stages quantize for it
+  screen.set_pixel_format(options.format);
+  constexpr std::array<void (FrameStream::*)(), stream_stage_count> stages{
+      &FrameStream::run_decode, &FrameStream::run_render, &FrameStream::run_dither, &FrameStream::run_upload};
+  for (size_t i = 0; i < stream_stage_count; i++) {
+    threads[i] = std::thread([this, stage = stages[i], i] {
+      try {
+        (this->*stage)();
+      } catch (const std::exception& e) {
+        log(LogLevel::Error, "Stream stage {} failed: {}", i, e.what());
+        stop();
+        if (static_cast<StreamStage>(i) == StreamStage::Upload) {
+          end_ns.store(nanoseconds_since(start), std::memory_order_relaxed);
+          finished.store(true, std::memory_order_release);
+        }
+      }
+    });
+  }
+}
+
+void FrameStream::hand_over(StreamStage stage, FrameExchange<Frame>& exchange, Clock::time_point started) {
+  auto& counter = counters[static_cast<size_t>(stage)];
+  counter.busy_ns.fetch_add(nanoseconds_since(started), std::memory_order_relaxed);
+  counter.frames.fetch_add(1, std::memory_order_relaxed);
+  if (!exchange.publish()) counter.dropped.fetch_add(1, std::memory_order_relaxed);
+  if (!options.latest_frame_wins) exchange.wait_until_taken();
+}
+
+void FrameStream::run_decode() {
+  cv::Mat raw;
+  auto    next_frame = Clock::now();
+  while (!stopping.load(std::memory_order_acquire)) {
+    if (frame_period != Clock::duration::zero()) {
+      std::this_thread::sleep_until(next_frame);
+      // A source that fell behind continues from now instead of rushing through the missed frames
+      next_frame = std::max(next_frame + frame_period, Clock::now());
+    }
+    const auto started = Clock::now();
+    if (!source(raw)) break;
+    if (raw.empty()) continue;
+    auto& frame = decoded.writable();
+    if (raw.channels() == 1) {
+      // The slot's old image goes back to the source to be decoded into
+      cv::swap(raw, frame.image);
+    } else {
+      cv::cvtColor(raw, frame.image, raw.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+    frame.captured = Clock::now();
+    hand_over(StreamStage::Decode, decoded, started);
+  }
+  decoded.close();
+}
+
+void FrameStream::run_render() {
+  const auto& info     = screen.get_system_info();
+  const auto  rotation = screen.get_rotation();
+  // Dithering needs the full 8 bit values, it quantizes afterwards
+  const auto quantization =
+      quantization_table(options.dither == DitherMode::None ? options.format : PixelFormat::Bpp8);
+  while (auto* input = decoded.take()) {
+    if (stopping.load(std::memory_order_acquire)) break;
+    const auto started = Clock::now();
+    auto&      frame   = rendered.writable();
+    frame.image.create(static_cast<int>(info.uiHeight), static_cast<int>(info.uiWidth), CV_8UC1);
+    render_to_panel(input->image, rotation, info.uiWidth, info.uiHeight, quantization,
+                    std::span(frame.image.data, frame.image.total()));
+    frame.captured = input->captured;
+    hand_over(StreamStage::Render, rendered, started);
+  }
+  rendered.close();
+}
+
+void FrameStream::run_dither() {
+  while (auto* input = rendered.take()) {
+    if (stopping.load(std::memory_order_acquire)) break;
+    const auto started = Clock::now();
+    auto&      frame   = dithered.writable();
+    // Both slots belong to this stage right now, so the images trade places instead of being copied
+    cv::swap(input->image, frame.image);
+    dither(frame.image, options.format, options.dither);
+    frame.captured = input->captured;
+    hand_over(StreamStage::Dither, dithered, started);
+  }
+  dithered.close();
+}
+
+void FrameStream::run_upload() {
+  auto& counter = counters[static_cast<size_t>(StreamStage::Upload)];
+  // How long the last uploads took, a frame is picked up that much before the panel is ready
+  Clock::duration upload_estimate{0};
+  while (!stopping.load(std::memory_order_acquire)) {
+    std::this_thread::sleep_until(screen.predicted_ready() - upload_estimate);
+    auto* input = dithered.take();
+    if (!input || stopping.load(std::memory_order_acquire)) break;
+    const auto started = Clock::now();
+    screen.display_rendered(input->image, options.wavemode);
+    const auto done    = Clock::now();
+    upload_estimate    = (upload_estimate * 3 + (done - started)) / 4;
+    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(done - input->captured).count();
+    total_latency_ns.fetch_add(latency, std::memory_order_relaxed);
+    auto max = max_latency_ns.load(std::memory_order_relaxed);
+    while (latency > max && !max_latency_ns.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {}
+    counter.busy_ns.fetch_add(nanoseconds_since(started), std::memory_order_relaxed);
+    counter.frames.fetch_add(1, std::memory_order_relaxed);
+    frames_shown.fetch_add(1, std::memory_order_relaxed);
+  }
+  end_ns.store(nanoseconds_since(start), std::memory_order_relaxed);
+  finished.store(true, std::memory_order_release);
+  log(LogLevel::Debug, "Stream ended after {} frames", frames_shown.load(std::memory_order_relaxed));
+}
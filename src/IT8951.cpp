@@ -7,6 +7,8 @@
 #include "EndianConversion.h"
 #include "log.hpp"
 #include <algorithm>
+#include <chrono>
+#include <fstream>
 
 #ifdef __linux__
 
@@ -17,45 +19,26 @@
 
 #endif
 
-/**
- * @warning ONLY USE THIS ON TYPES OF WHICH ALL MEMBERS ARE UINT32_T
- * @tparam T Struct of which all members are uint32_t and need to be swapped
- * @param t original value
- * @return new swapped value;
- */
-template<typename T>
-T host_to_be_uint32t_members(const T &t) {
-    auto copy = t;
-    auto copyptr = reinterpret_cast<uint32_t *>(&copy);
-    for (int i = 0; i < sizeof(T) / sizeof(uint32_t); i++) {
-        copyptr[i] = htobe32(copyptr[i]);
-    }
-    return copy;
+std::optional<uint32_t> IT8951::read_status() const {
+    // LUTAFSR, status == 0 means ready else TCon engine is busy
+    return read_register(0x18001224);
 }
 
-/**
- * @warning ONLY USE THIS ON TYPES OF WHICH ALL MEMBERS ARE UINT32_T
- * @tparam T Struct of which all members are uint32_t and need to be swapped
- * @param t original value
- * @return new swapped value;
- */
-template<typename T>
-T be_to_host_uint32t_members(const T &t) {
-    auto copy = t;
-    auto copyptr = reinterpret_cast<uint32_t *>(&copy);
-    for (int i = 0; i < sizeof(T) / sizeof(uint32_t); i++) {
-        copyptr[i] = be32toh(copyptr[i]);
-    }
-    return copy;
+bool IT8951::wait_until_ready() const {
+    return readiness->wait_until_ready();
+}
+
+std::future<bool> IT8951::when_ready(std::function<void(bool)> callback) const {
+    return readiness->when_ready(std::move(callback));
 }
 
-void IT8951::wait_until_ready() const {
-    // status == 0 means ready else TCon engine is busy
-    while (read_register(0x18001224).value_or(0xFFFF) & 0xFFFF);
+ReadinessTracker::Clock::time_point IT8951::predicted_ready() const {
+    return readiness->predicted_ready();
 }
 
 constexpr std::array<uint8_t, 16> make_command_cdb_data(uint32_t address,
-                                                        uint8_t command) {
+                                                        uint8_t command,
+                                                        uint16_t length = sizeof(uint32_t)) {
     // clang-format off
   return {{
       0xFE, 0x00,
@@ -65,11 +48,27 @@ constexpr std::array<uint8_t, 16> make_command_cdb_data(uint32_t address,
       (uint8_t)((address >> 8) & 0xFF),
       (uint8_t)((address)&0xFF),
       command,  // IT8951 USB WriteReg
-      0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      // Byte 7-8 data length BigEndian
+      (uint8_t)((length >> 8) & 0xFF),
+      (uint8_t)((length)&0xFF),
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   }};
   // clang-format on
 }
 
+constexpr uint8_t read_memory_command = 0x81;
+constexpr uint8_t write_memory_command = 0x82;
+constexpr uint8_t fast_write_memory_command = 0xA5;
+// The memory commands carry their length in 16 bits, kept a multiple of 4 so registers aren't split
+constexpr size_t max_memory_command_bytes = 0xFFFC;
+
+// clang-format off
+constexpr std::array<uint8_t, 16> load_image_area_cdb{{
+    0xFE,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0xA2, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+// clang-format on
+
 bool IT8951::write_register(uint32_t address, uint32_t value) const {
     const auto cdb_data = make_command_cdb_data(address, 0x84);
     std::array<uint8_t, 4> data_big_endian{
@@ -80,9 +79,119 @@ bool IT8951::write_register(uint32_t address, uint32_t value) const {
 
 std::optional<uint32_t> IT8951::read_register(uint32_t address) const {
     const auto cdb_data = make_command_cdb_data(address, 0x83);
-    auto x = driver.get_data(1, cdb_data);
-    if (!x || x->size() < 4) { return std::nullopt; }
-    return be32toh(*reinterpret_cast<uint32_t *>(x->data()));
+    std::array<uint8_t, sizeof(uint32_t)> data_big_endian{};
+    const auto received = driver.get_data(data_big_endian, cdb_data);
+    if (!received || *received < data_big_endian.size()) { return std::nullopt; }
+    return static_cast<uint32_t>(data_big_endian[0]) << 24 | static_cast<uint32_t>(data_big_endian[1]) << 16 |
+           static_cast<uint32_t>(data_big_endian[2]) << 8 | data_big_endian[3];
+}
+
+bool IT8951::read_memory(uint32_t address, std::span<uint8_t> data) const {
+    const auto chunk = std::min(driver.max_transfer_size(), max_memory_command_bytes);
+    for (size_t offset = 0; offset < data.size(); offset += chunk) {
+        const auto part = data.subspan(offset, std::min(chunk, data.size() - offset));
+        const auto cdb_data = make_command_cdb_data(address + offset, read_memory_command,
+                                                     static_cast<uint16_t>(part.size()));
+        const auto received = driver.get_data(part, cdb_data);
+        if (!received || *received < part.size()) {
+            log(LogLevel::Error, "Reading {} bytes of memory at {:#x} failed", part.size(), address + offset);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IT8951::write_memory(uint32_t address, std::span<const uint8_t> data) const {
+    return write_memory_chunks(write_memory_command, address, data);
+}
+
+bool IT8951::read_registers(uint32_t address, std::span<uint32_t> values) const {
+    const auto bytes = std::span(reinterpret_cast<uint8_t *>(values.data()), values.size_bytes());
+    if (!read_memory(address, bytes)) { return false; }
+    for (size_t i = 0; i < values.size(); i++) {
+        const auto *word = bytes.data() + i * sizeof(uint32_t);
+        values[i] = static_cast<uint32_t>(word[3]) << 24 | static_cast<uint32_t>(word[2]) << 16 |
+                    static_cast<uint32_t>(word[1]) << 8 | word[0];
+    }
+    return true;
+}
+
+bool IT8951::write_registers(uint32_t address, std::span<const uint32_t> values) const {
+    // Converted a block at a time on the stack, each block is one write memory command
+    std::array<uint8_t, 1024> data_little_endian{};
+    constexpr size_t block = data_little_endian.size() / sizeof(uint32_t);
+    for (size_t first = 0; first < values.size(); first += block) {
+        const auto part = values.subspan(first, std::min(block, values.size() - first));
+        for (size_t i = 0; i < part.size(); i++) {
+            for (size_t byte = 0; byte < sizeof(uint32_t); byte++) {
+                data_little_endian[i * sizeof(uint32_t) + byte] = static_cast<uint8_t>(part[i] >> (8 * byte));
+            }
+        }
+        if (!write_memory(address + first * sizeof(uint32_t),
+                          std::span(data_little_endian).first(part.size_bytes()))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IT8951::write_memory_chunks(uint8_t command, uint32_t address, std::span<const uint8_t> data) const {
+    const auto chunk = std::min({transfer_size, driver.max_transfer_size(), max_memory_command_bytes});
+    if (max_in_flight <= 1) {
+        for (size_t offset = 0; offset < data.size(); offset += chunk) {
+            const auto part = data.subspan(offset, std::min(chunk, data.size() - offset));
+            const auto cdb_data = make_command_cdb_data(address + offset, command, static_cast<uint16_t>(part.size()));
+            if (!driver.write_data(cdb_data, part)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The kernel copies the command when it's queued, so only the data has to stay alive
+    size_t queued = 0;
+    bool ok = true;
+    const auto complete_one = [&]() {
+        const auto completion = driver.wait_for_completion();
+        if (!completion) { return false; }
+        queued--;
+        if (!completion->ok || completion->resid != 0) {
+            log(LogLevel::Error, "Memory write {} failed, {} bytes not sent", completion->id, completion->resid);
+            ok = false;
+        }
+        return true;
+    };
+    for (size_t offset = 0; offset < data.size() && ok; offset += chunk) {
+        if (queued >= max_in_flight && !complete_one()) {
+            drain_in_flight();
+            return false;
+        }
+        const std::array<std::span<const uint8_t>, 1> segments{
+                data.subspan(offset, std::min(chunk, data.size() - offset))};
+        const auto cdb_data = make_command_cdb_data(address + offset, command,
+                                                    static_cast<uint16_t>(segments[0].size()));
+        if (!driver.submit_write(cdb_data, segments)) {
+            ok = false;
+            break;
+        }
+        queued++;
+    }
+    while (queued > 0) {
+        if (!complete_one()) {
+            drain_in_flight();
+            return false;
+        }
+    }
+    return ok;
+}
+
+bool IT8951::set_upload_engine(UploadEngine engine) {
+    if (engine == UploadEngine::FastWriteMemory && !get_system_info()) {
+        log(LogLevel::Error, "Fast write memory needs the panel width, but the system info can't be read");
+        return false;
+    }
+    upload_engine = engine;
+    return true;
 }
 
 std::optional<IT8951SystemInfo> IT8951::get_system_info() {
@@ -98,6 +207,7 @@ std::optional<IT8951SystemInfo> IT8951::get_system_info() {
     if (!x.has_value() || x->empty()) { return std::nullopt; }
     const auto f = reinterpret_cast<const IT8951SystemInfo *>(x->data());
     cached_system_info = be_to_host_uint32t_members<IT8951SystemInfo>(*f);
+    readiness->set_frame_counts(cached_system_info->uiFrameCount);
     return cached_system_info;
 }
 
@@ -109,61 +219,285 @@ bool IT8951::is_it8951() const {
                                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
   // clang-format on
     const auto x = driver.get_data(0x28, cdb_data);
-    if (!x.has_value() || x->empty()) { return false; }
+    return x.has_value() && identifies_as_it8951(*x);
+}
+
+bool IT8951::identifies_as_it8951(std::span<const uint8_t> inquiry_data) {
+    // Vendor, product and revision start at byte 8
     const std::string_view expected = "Generic Storage RamDisc 1.00";
-    return expected == std::string_view((const char *) x->data() + 8, expected.size());
+    if (inquiry_data.size() < 8 + expected.size()) { return false; }
+    return expected == std::string_view((const char *) inquiry_data.data() + 8, expected.size());
 }
 
-void IT8951::load_image_area(const IT8951Area &area, std::span<uint8_t> pixelData) {
+void IT8951::load_image_area(const IT8951Area &area, std::span<const uint8_t> pixelData) {
     load_image_area({.address = get_system_info()->uiImageBufBase, .area = area},
                     pixelData);
 }
 
 void IT8951::load_image_area(const IT8951ImgLoadArea &area,
-                             std::span<uint8_t> pixelData) const {
-    const auto size = area.area.w * area.area.h;
-    assert(size <= pixelData.size());
-    // Largest image in 1 packet is 247x247 pixels
-    if (size > SPT_BUF_SIZE) {
+                             std::span<const uint8_t> pixelData) const {
+    load_image_area(area, pixelData, area.area.w);
+}
+
+bool IT8951::load_image_area(const IT8951ImgLoadArea &area, std::span<const uint8_t> pixelData,
+                             size_t stride) const {
+    assert(stride >= area.area.w);
+    assert(area.area.h == 0 || stride * (area.area.h - 1) + area.area.w <= pixelData.size());
+    // Full width rows follow each other in the image buffer, so they are one run of bytes
+    if (upload_engine == UploadEngine::FastWriteMemory && cached_system_info &&
+        area.area.x == 0 && area.area.w == cached_system_info->uiWidth && stride == area.area.w) {
+        const auto address = area.address + area.area.y * cached_system_info->uiWidth;
+        if (!write_memory_chunks(fast_write_memory_command, address,
+                                 pixelData.first(static_cast<size_t>(area.area.w) * area.area.h))) {
+            return false;
+        }
+        log(LogLevel::Debug, "Fast wrote image of {}x{} to line {}", area.area.w, area.area.h, area.area.y);
+        return true;
+    }
+    // With the default 60KB the largest square image in 1 packet is 247x247 pixels
+    uint32_t lines = std::clamp<uint32_t>((transfer_size - sizeof(IT8951ImgLoadArea)) / area.area.w,
+                                          1, std::max(area.area.h, 1u));
+    if (stride != area.area.w) {
+        // Every row is its own segment next to the header
+        lines = std::min<uint32_t>(lines, driver.max_segment_count() - 1);
+    }
+    if (lines < area.area.h) {
         log(LogLevel::Debug, "Image is too big to send at once");
+    }
+    if (max_in_flight > 1) {
+        return load_image_chunks_pipelined(area, pixelData, stride, lines);
+    }
+    for (uint32_t line = 0; line < area.area.h; line += lines) {
+        const auto chunk_lines = std::min(lines, area.area.h - line);
+        if (lines < area.area.h) {
+            log(LogLevel::Debug, "Sending chunk of {} lines to line offset {}", chunk_lines,
+                area.area.y + line);
+        }
+        if (!load_image_chunk({.address = area.address,
+                                      .area{.x = area.area.x,
+                                              .y = area.area.y + line,
+                                              .w = area.area.w,
+                                              .h = chunk_lines}},
+                              pixelData.subspan(line * stride), stride)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        uint32_t offset = 0;
-        uint32_t lines = (SPT_BUF_SIZE - sizeof(IT8951ImgLoadArea)) / area.area.w;
+bool IT8951::load_image_chunk(const IT8951ImgLoadArea &area, std::span<const uint8_t> pixelData,
+                              size_t stride) const {
+    const auto prepared_area = host_to_be_uint32t_members(area);
+    // Header and pixels go to the kernel as separate segments, the caller's buffer isn't copied
+    const auto header = std::span(reinterpret_cast<const uint8_t *>(&prepared_area), sizeof(prepared_area));
+    if (!driver.write_data_strided(load_image_area_cdb, header, pixelData, area.area.w, area.area.h, stride)) {
+        return false;
+    }
+    log(LogLevel::Debug, "Sent image of {}x{} to {},{}", area.area.w, area.area.h,
+    area.area.x, area.area.y);
+    return true;
+}
 
-        while (offset < size) {
-            if (offset / area.area.w + lines > area.area.h) {
-                lines = area.area.h - offset / area.area.w;
+void IT8951::drain_in_flight() const {
+    // Bounded, a device that stopped answering mustn't hang the caller forever
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (driver.in_flight_count() > 0) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0 || !driver.wait_for_completion(static_cast<int>(left.count()))) {
+            log(LogLevel::Error, "Gave up on {} requests still in flight", driver.in_flight_count());
+            // They may still point at the caller's headers and pixels, which are gone once it returns
+            driver.abandon_in_flight();
+            return;
+        }
+    }
+}
+
+bool IT8951::load_image_chunks_pipelined(const IT8951ImgLoadArea &area, std::span<const uint8_t> pixelData,
+                                         size_t stride, uint32_t lines) const {
+    // A header has to live until its chunk completes, so every request in flight gets a slot
+    std::array<IT8951ImgLoadArea, SPT_MAX_IN_FLIGHT> headers{};
+    std::array<std::optional<uint32_t>, SPT_MAX_IN_FLIGHT> slot_ids{};
+    const auto slots = std::span(slot_ids).first(max_in_flight);
+    bool ok = true;
+
+    const auto complete_one = [&]() {
+        const auto completion = driver.wait_for_completion();
+        if (!completion) { return false; }
+        if (!completion->ok || completion->resid != 0) {
+            log(LogLevel::Error, "Image chunk {} failed, {} bytes not sent", completion->id, completion->resid);
+            ok = false;
+        }
+        std::replace(slots.begin(), slots.end(), std::optional(completion->id), std::optional<uint32_t>());
+        return true;
+    };
+
+    for (uint32_t line = 0; line < area.area.h && ok; line += lines) {
+        auto slot = std::find(slots.begin(), slots.end(), std::nullopt);
+        while (slot == slots.end()) {
+            if (!complete_one()) {
+                drain_in_flight();
+                return false;
             }
-            log(LogLevel::Debug, "Sending chunk of {} lines to line offset {}", lines,
-            area.area.y + offset / area.area.w);
-            load_image_area({.address = area.address,
-                                    .area{.x = area.area.x,
-                                            .y = area.area.y + offset / area.area.w,
-                                            .w = area.area.w,
-                                            .h = lines}},
-                            pixelData.subspan(offset, lines * area.area.w));
-            offset += lines * area.area.w;
+            slot = std::find(slots.begin(), slots.end(), std::nullopt);
+        }
+        // Chunk N+1 is prepared and queued while the device is still busy with chunk N
+        const auto chunk_lines = std::min(lines, area.area.h - line);
+        auto &header = headers[slot - slots.begin()];
+        header = host_to_be_uint32t_members(IT8951ImgLoadArea{.address = area.address,
+                                                              .area{.x = area.area.x,
+                                                                      .y = area.area.y + line,
+                                                                      .w = area.area.w,
+                                                                      .h = chunk_lines}});
+        *slot = driver.submit_write_strided(load_image_area_cdb,
+                                            std::span(reinterpret_cast<const uint8_t *>(&header), sizeof(header)),
+                                            pixelData.subspan(line * stride), area.area.w, chunk_lines, stride);
+        if (!*slot) { ok = false; }
+    }
+    while (std::any_of(slots.begin(), slots.end(), [](const auto &id) { return id.has_value(); })) {
+        if (!complete_one()) {
+            drain_in_flight();
+            return false;
         }
+    }
+    log(LogLevel::Debug, "Sent image of {}x{} to {},{} pipelined", area.area.w, area.area.h,
+        area.area.x, area.area.y);
+    return ok;
+}
+
+void IT8951::set_max_in_flight(size_t requests) {
+    max_in_flight = std::clamp<size_t>(requests, 1, SPT_MAX_IN_FLIGHT);
+}
+
+void IT8951::set_transfer_size(size_t size) {
+    transfer_size = std::clamp<size_t>(size, sizeof(IT8951ImgLoadArea) + 1, driver.max_transfer_size());
+}
+
+size_t IT8951::autotune_transfer_size(const std::filesystem::path &cache_file) {
+    const auto &device = driver.get_path();
+    if (!cache_file.empty()) {
+        std::ifstream cache(cache_file);
+        std::string cached_device;
+        size_t cached_size;
+        while (cache >> cached_device >> cached_size) {
+            if (cached_device == device) {
+                set_transfer_size(cached_size);
+                log(LogLevel::Info, "Using cached transfer size {} for {}", transfer_size, device);
+                return transfer_size;
+            }
+        }
+    }
+
+    const auto info = get_system_info();
+    if (!info) { return transfer_size; }
+    const std::vector<uint8_t> frame(info->uiWidth * info->uiHeight, 0xFF);
+    const IT8951ImgLoadArea area{.address = info->uiImageBufBase,
+                                 .area = {.x = 0, .y = 0, .w = info->uiWidth, .h = info->uiHeight}};
+
+    std::vector<size_t> candidates;
+    for (size_t size = SPT_BUF_SIZE; size < driver.max_transfer_size(); size *= 2) {
+        candidates.push_back(size);
+    }
+    candidates.push_back(driver.max_transfer_size());
+
+    const auto original_size = transfer_size;
+    size_t best_size = original_size;
+    double best_rate = 0;
+    for (const auto size : candidates) {
+        set_transfer_size(size);
+        // Best of a few runs so a single hiccup on the bus doesn't decide
+        double rate = 0;
+        bool failed = false;
+        for (int run = 0; run < 3 && !failed; run++) {
+            const auto start = std::chrono::steady_clock::now();
+            failed = !load_image_area(area, frame, area.area.w);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            rate = std::max(rate, frame.size() / elapsed.count());
+        }
+        if (failed) {
+            log(LogLevel::Info, "Transfer size {} failed, not trying larger ones", transfer_size);
+            break;
+        }
+        log(LogLevel::Info, "Transfer size {}: {:.1f} MB/s", transfer_size, rate / 1e6);
+        if (rate > best_rate) {
+            best_rate = rate;
+            best_size = transfer_size;
+        }
+    }
+    transfer_size = best_size;
+
+    if (!cache_file.empty() && best_rate > 0) {
+        std::ofstream cache(cache_file, std::ios::app);
+        cache << device << ' ' << transfer_size << '\n';
+    }
+    return transfer_size;
+}
+
+bool IT8951::load_image_area(const IT8951ImgLoadArea &area, std::span<const uint8_t> pixelData,
+                             size_t stride, PixelFormat format, const ToneMap *tone_map,
+                             std::pmr::memory_resource *memory) {
+    const bool packed = loads_packed(area.area, format);
+    if (format == PixelFormat::Bpp1 && !packed) {
+        log(LogLevel::Debug, "1bpp area {}x{} at {},{} isn't aligned, sending 8bpp", area.area.w,
+            area.area.h, area.area.x, area.area.y);
+    }
+    if (packed) {
+        std::pmr::vector<uint8_t> packed_pixels(packed_row_bytes(area.area.w, format) * area.area.h, memory);
+        pack_pixels(pixelData, stride, area.area.w, area.area.h, format, packed_pixels, tone_map);
+        return load_prepared_image_area(area, packed_pixels, format);
+    }
+    set_1bpp_mode(false);
+    if (format == PixelFormat::Bpp8 && tone_map == nullptr) {
+        return load_image_area(area, pixelData, stride);
+    }
+    std::pmr::vector<uint8_t> quantized(area.area.w * area.area.h, memory);
+    quantize_pixels(pixelData, stride, area.area.w, area.area.h, format, quantized, tone_map);
+    return load_image_area(area, quantized, area.area.w);
+}
+
+bool IT8951::loads_packed(const IT8951Area &area, PixelFormat format) {
+    const auto alignment = pixel_alignment(PixelFormat::Bpp1);
+    return format == PixelFormat::Bpp1 && area.x % alignment == 0 && area.w % alignment == 0;
+}
+
+uint64_t IT8951::transfer_bytes(const IT8951Area &area, PixelFormat format) {
+    if (!loads_packed(area, format)) { return static_cast<uint64_t>(area.w) * area.h; }
+    return static_cast<uint64_t>(packed_row_bytes(area.w, format)) * area.h;
+}
+
+bool IT8951::load_prepared_image_area(const IT8951ImgLoadArea &area, std::span<const uint8_t> data,
+                                      PixelFormat format) {
+    set_1bpp_mode(format == PixelFormat::Bpp1);
+    if (format != PixelFormat::Bpp1) {
+        return load_image_area(area, data, area.area.w);
+    }
+    // The load engine only knows bytes, so coordinates are given in bytes as well
+    return load_image_area({.address = area.address,
+                                   .area = {.x = area.area.x / 8,
+                                           .y = area.area.y,
+                                           .w = area.area.w / 8,
+                                           .h = area.area.h}},
+                           data, area.area.w / 8);
+}
+
+void IT8951::set_1bpp_mode(bool enable) {
+    if (enable == one_bpp_mode) { return; }
+    // UP1SR bit 18 makes the display engine read the image buffer as 1bpp
+    constexpr uint32_t UP1SR = 0x18001138;
+    // Gray level for set bits in [7:0], for cleared bits in [15:8]
+    constexpr uint32_t BGVR = 0x18001250;
+    const auto up1sr = read_register(UP1SR);
+    if (!up1sr) {
+        log(LogLevel::Error, "Couldn't read UP1SR to switch 1bpp mode");
         return;
     }
-    auto prepared_area = host_to_be_uint32t_members(area);
-    // clang-format off
-  const auto cdb_data =
-      std::array<uint8_t, 16>({0xFE,
-                               0x00, 0x00, 0x00, 0x00, 0x00, 0xA2, 0x00, 0x00,
-                               0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
-  // clang-format on
-    auto data_buffer =
-            std::vector<uint8_t>(sizeof(prepared_area) + area.area.w * area.area.h);
-    // order between memcpy and copy_n is different :/
-    // dest src size
-    std::memcpy(data_buffer.data(), &prepared_area, sizeof(prepared_area));
-    // src size dest
-    std::copy_n(pixelData.begin(), area.area.w * area.area.h,
-                data_buffer.begin() + sizeof(prepared_area));
-    driver.write_data(cdb_data, data_buffer);
-    log(LogLevel::Debug, "Sent image of {}x{} to {},{}", area.area.w, area.area.h,
-    area.area.x, area.area.y);
+    const bool written = enable ? write_register(BGVR, (0x00 << 8) | 0xF0) &&
+                                  write_register(UP1SR, *up1sr | (1 << 18))
+                                : write_register(UP1SR, *up1sr & ~(1 << 18));
+    if (!written) {
+        log(LogLevel::Error, "Couldn't switch 1bpp mode");
+        return;
+    }
+    one_bpp_mode = enable;
 }
 
 void IT8951::display_image_area(const IT8951DisplayArea &area) const {
@@ -176,7 +510,9 @@ void IT8951::display_image_area(const IT8951DisplayArea &area) const {
   // clang-format on
     std::array<uint8_t, sizeof(prepared_area)> buf{};
     std::memcpy(buf.data(), &prepared_area, buf.size());
-    driver.write_data(cdb_data, buf);
+    if (driver.write_data(cdb_data, buf)) {
+        readiness->refresh_started(area.wavemode, static_cast<uint64_t>(area.area.w) * area.area.h);
+    }
 }
 
 void IT8951::display_image_area(const IT8951Area &area, WaveMode wavemode) {
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "ImageDecode.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct SpanReader {
+  std::span<const uint8_t> data;
+
+  bool read(uint64_t offset, std::span<uint8_t> out) {
+    if (offset > data.size() || data.size() - offset < out.size()) return false;
+    std::memcpy(out.data(), data.data() + offset, out.size());
+    return true;
+  }
+};
+
+struct FileReader {
+  std::ifstream file;
+
+  bool read(uint64_t offset, std::span<uint8_t> out) {
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    return static_cast<size_t>(file.gcount()) == out.size();
+  }
+};
+
+uint32_t be16(const uint8_t* p) { return static_cast<uint32_t>(p[0]) << 8 | p[1]; }
+uint32_t be32(const uint8_t* p) { return be16(p) << 16 | be16(p + 2); }
+
+// EXIF orientations 5 to 8 store the image transposed, imread turns it the right way round
+bool exif_swaps_axes(std::span<const uint8_t> exif) {
+  constexpr std::array<uint8_t, 6> signature{'E', 'x', 'i', 'f', 0, 0};
+  if (exif.size() < 14 || !std::equal(signature.begin(), signature.end(), exif.begin())) return false;
+  const auto tiff   = exif.subspan(6);
+  const bool little = tiff[0] == 'I';
+  const auto u16    = [&](size_t at) {
+    return little ? static_cast<uint32_t>(tiff[at + 1]) << 8 | tiff[at] : be16(&tiff[at]);
+  };
+  const auto u32 = [&](size_t at) { return little ? u16(at + 2) << 16 | u16(at) : be32(&tiff[at]); };
+  const auto ifd = static_cast<size_t>(u32(4));
+  if (ifd + 2 > tiff.size()) return false;
+  const auto entries = u16(ifd);
+  for (size_t i = 0; i < entries && ifd + 2 + (i + 1) * 12 <= tiff.size(); i++) {
+    const auto entry = ifd + 2 + i * 12;
+    if (u16(entry) == 0x0112) return u16(entry + 8) >= 5 && u16(entry + 8) <= 8;
+  }
+  return false;
+}
+
+template <typename Reader>
+std::optional<ImageHeader> parse_header(Reader& reader) {
+  std::array<uint8_t, 24> start{};
+  if (!reader.read(0, std::span(start).first(8))) return std::nullopt;
+
+  constexpr std::array<uint8_t, 8> png_signature{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  if (std::equal(png_signature.begin(), png_signature.end(), start.begin())) {
+    // IHDR always comes first
+    if (!reader.read(0, start) || std::memcmp(&start[12], "IHDR", 4) != 0) return std::nullopt;
+    return ImageHeader{.codec = ImageHeader::Codec::Png, .width = be32(&start[16]), .height = be32(&start[20])};
+  }
+  if (start[0] != 0xFF || start[1] != 0xD8) return std::nullopt;
+
+  bool                   swapped = false;
+  uint64_t               offset  = 2;
+  std::array<uint8_t, 9> segment{};
+  std::vector<uint8_t>   exif;
+  while (reader.read(offset, std::span(segment).first(4))) {
+    if (segment[0] != 0xFF) return std::nullopt;
+    const auto marker = segment[1];
+    if (marker == 0xFF) {
+      offset++;  // Fill byte
+      continue;
+    }
+    const auto length = be16(&segment[2]);
+    if (marker == 0xDA || marker == 0xD9 || length < 2) return std::nullopt;  // Scan data before a frame header
+    // SOF0 to SOF15, except DHT, JPG and DAC which share the range
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      if (!reader.read(offset, segment)) return std::nullopt;
+      auto width  = be16(&segment[7]);
+      auto height = be16(&segment[5]);
+      if (swapped) std::swap(width, height);
+      return ImageHeader{.codec = ImageHeader::Codec::Jpeg, .width = width, .height = height};
+    }
+    if (marker == 0xE1 && !swapped) {
+      exif.resize(length - 2);
+      if (reader.read(offset + 4, exif)) swapped = exif_swaps_axes(exif);
+    }
+    offset += 2 + length;
+  }
+  return std::nullopt;
+}
+
+int reduced_grayscale_flag(uint32_t factor) {
+  switch (factor) {
+    case 2: return cv::IMREAD_REDUCED_GRAYSCALE_2;
+    case 4: return cv::IMREAD_REDUCED_GRAYSCALE_4;
+    case 8: return cv::IMREAD_REDUCED_GRAYSCALE_8;
+    default: return cv::IMREAD_GRAYSCALE;
+  }
+}
+
+template <typename Header, typename Decode>
+cv::Mat decode_reduced(Header&& read_header, Decode&& decode, int rotation, uint32_t width, uint32_t height,
+                       DecodeTimings* timings) {
+  const auto start  = Clock::now();
+  const auto header = read_header();
+  const auto parsed = Clock::now();
+  const auto factor = header ? reduced_decode_factor(*header, rotation, width, height) : 1;
+  cv::Mat    image  = decode(reduced_grayscale_flag(factor));
+  if (timings) {
+    timings->header = parsed - start;
+    timings->decode = Clock::now() - parsed;
+    timings->factor = factor;
+  }
+  return image;
+}
+}  // namespace
+
+std::optional<ImageHeader> read_image_header(const std::filesystem::path& path) {
+  FileReader reader{std::ifstream(path, std::ios::binary)};
+  if (!reader.file) return std::nullopt;
+  return parse_header(reader);
+}
+
+std::optional<ImageHeader> read_image_header(std::span<const uint8_t> encoded) {
+  SpanReader reader{encoded};
+  return parse_header(reader);
+}
+
+uint32_t reduced_decode_factor(const ImageHeader& header, int rotation, uint32_t width, uint32_t height) {
+  if (header.codec != ImageHeader::Codec::Jpeg) return 1;
+  // A quarter turn makes the image's width the panel's height
+  if (rotation == cv::ROTATE_90_CLOCKWISE || rotation == cv::ROTATE_90_COUNTERCLOCKWISE) std::swap(width, height);
+  // libjpeg rounds scaled sizes up
+  const auto covers = [&](uint32_t factor) {
+    return (header.width + factor - 1) / factor >= width && (header.height + factor - 1) / factor >= height;
+  };
+  uint32_t factor = 8;
+  while (factor > 1 && !covers(factor)) factor /= 2;
+  return factor;
+}
+
+cv::Mat decode_for_panel(const std::filesystem::path& path, int rotation, uint32_t width, uint32_t height,
+                         DecodeTimings* timings) {
+  return decode_reduced([&] { return read_image_header(path); },
+                        [&](int flags) { return cv::imread(path.string(), flags); }, rotation, width, height,
+                        timings);
+}
+
+cv::Mat decode_for_panel(std::span<const uint8_t> encoded, int rotation, uint32_t width, uint32_t height,
+                         DecodeTimings* timings) {
+  // imdecode only reads the buffer, the Mat just wraps it
+  const cv::Mat buffer(1, static_cast<int>(encoded.size()), CV_8UC1, const_cast<uint8_t*>(encoded.data()));
+  return decode_reduced([&] { return read_image_header(encoded); },
+                        [&](int flags) { return cv::imdecode(buffer, flags); }, rotation, width, height, timings);
+}
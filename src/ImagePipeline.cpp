@@ -0,0 +1,92 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "ImagePipeline.hpp"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace {
+constexpr uint32_t tile_size = 64;
+// Bilinear weights are 8 bit fixed point
+constexpr int weight_bits = 8;
+constexpr int weight_one  = 1 << weight_bits;
+
+struct Axis {
+  std::pmr::vector<ptrdiff_t> offset;  // Source offset of the first sample
+  std::pmr::vector<ptrdiff_t> next;    // From the first to the second sample
+  std::pmr::vector<int>       weight;  // Of the second sample
+};
+
+// Same sample positions as cv::resize with INTER_LINEAR
+Axis make_axis(uint32_t out_size, uint32_t in_size, ptrdiff_t step, std::pmr::memory_resource* memory) {
+  Axis axis{std::pmr::vector<ptrdiff_t>(out_size, memory), std::pmr::vector<ptrdiff_t>(out_size, memory),
+            std::pmr::vector<int>(out_size, memory)};
+  const double scale = static_cast<double>(in_size) / out_size;
+  for (uint32_t o = 0; o < out_size; o++) {
+    const double position = std::clamp((o + 0.5) * scale - 0.5, 0.0, static_cast<double>(in_size - 1));
+    const auto   first    = static_cast<uint32_t>(position);
+    const auto   second   = std::min(first + 1, in_size - 1);
+    axis.offset[o]        = static_cast<ptrdiff_t>(first) * step;
+    axis.next[o]          = static_cast<ptrdiff_t>(second - first) * step;
+    axis.weight[o]        = static_cast<int>((position - first) * weight_one + 0.5);
+  }
+  return axis;
+}
+}  // namespace
+
+void render_to_panel(const cv::Mat& src, int rotation, uint32_t width, uint32_t height,
+                     const std::array<uint8_t, 256>& quantization, std::span<uint8_t> dst,
+                     std::pmr::memory_resource* memory) {
+  assert(src.elemSize() == 1);
+  assert(dst.size() >= static_cast<size_t>(width) * height);
+  const auto src_w = static_cast<ptrdiff_t>(src.cols);
+  const auto src_h = static_cast<ptrdiff_t>(src.rows);
+  const auto step  = static_cast<ptrdiff_t>(src.step[0]);
+
+  // Every rotation is linear in the rotated coordinates: origin + x * dx + y * dy
+  ptrdiff_t origin = 0, dx = 1, dy = step;
+  uint32_t  rotated_w = src.cols, rotated_h = src.rows;
+  switch (rotation) {
+    case cv::ROTATE_90_CLOCKWISE:
+      origin = (src_h - 1) * step, dx = -step, dy = 1;
+      rotated_w = src.rows, rotated_h = src.cols;
+      break;
+    case cv::ROTATE_180:
+      origin = (src_h - 1) * step + src_w - 1, dx = -1, dy = -step;
+      break;
+    case cv::ROTATE_90_COUNTERCLOCKWISE:
+      origin = src_w - 1, dx = step, dy = -1;
+      rotated_w = src.rows, rotated_h = src.cols;
+      break;
+    default: break;
+  }
+
+  const auto     columns = make_axis(width, rotated_w, dx, memory);
+  const auto     rows    = make_axis(height, rotated_h, dy, memory);
+  const uint8_t* base    = src.ptr<uint8_t>(0) + origin;
+
+  for (uint32_t tile_y = 0; tile_y < height; tile_y += tile_size) {
+    const auto tile_bottom = std::min(tile_y + tile_size, height);
+    for (uint32_t tile_x = 0; tile_x < width; tile_x += tile_size) {
+      const auto tile_right = std::min(tile_x + tile_size, width);
+      for (uint32_t y = tile_y; y < tile_bottom; y++) {
+        const uint8_t* row      = base + rows.offset[y];
+        const auto     next_y   = rows.next[y];
+        const int      weight_y = rows.weight[y];
+        uint8_t*       out      = dst.data() + static_cast<size_t>(y) * width;
+        for (uint32_t x = tile_x; x < tile_right; x++) {
+          const uint8_t* p        = row + columns.offset[x];
+          const auto     next_x   = columns.next[x];
+          const int      weight_x = columns.weight[x];
+          const int      top      = p[0] * (weight_one - weight_x) + p[next_x] * weight_x;
+          const int      bottom   = p[next_y] * (weight_one - weight_x) + p[next_y + next_x] * weight_x;
+          const int      value =
+              (top * (weight_one - weight_y) + bottom * weight_y + (1 << (2 * weight_bits - 1))) >> (2 * weight_bits);
+          out[x] = quantization[value];
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "MultiPanel.hpp"
+#include <algorithm>
+#include <future>
+#include "log.hpp"
+
+std::vector<std::string> panel_candidates() {
+  std::vector<std::string> candidates;
+#ifdef __linux__
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator("/dev", error)) {
+    const auto name = entry.path().filename().string();
+    if (name.starts_with("sg")) candidates.push_back(entry.path().string());
+  }
+  // sg10 after sg9
+  std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+    return a.size() != b.size() ? a.size() < b.size() : a < b;
+  });
+#endif
+#ifdef WIN32
+  for (int drive = 0; drive < 16; drive++) candidates.push_back(fmt::format("\\\\.\\PhysicalDrive{}", drive));
+#endif
+  return candidates;
+}
+
+std::vector<PanelInfo> discover_panels(const std::vector<std::string>& candidates) {
+  std::vector<std::future<std::optional<PanelInfo>>> probes;
+  probes.reserve(candidates.size());
+  for (const auto& path : candidates) {
+    probes.push_back(std::async(std::launch::async, [path]() -> std::optional<PanelInfo> {
+      // Opening a driver sets the device up for transfers, only IT8951s get that far
+      const auto inquiry = ScsiDriver::inquiry(path.c_str());
+      if (!inquiry || !IT8951::identifies_as_it8951(*inquiry)) return std::nullopt;
+      try {
+        IT8951 it{ScsiDriver(path.c_str())};
+        const auto info = it.get_system_info();
+        if (!info) {
+          log(LogLevel::Warning, "{} is an IT8951 but its system info can't be read", path);
+          return std::nullopt;
+        }
+        return PanelInfo{path, *info};
+      } catch (const std::exception& e) {
+        log(LogLevel::Debug, "Skipping {}: {}", path, e.what());
+        return std::nullopt;
+      }
+    }));
+  }
+  std::vector<PanelInfo> panels;
+  for (auto& probe : probes) {
+    if (auto panel = probe.get()) {
+      log(LogLevel::Info, "Found {}x{} panel at {}", panel->info.uiWidth, panel->info.uiHeight, panel->path);
+      panels.push_back(std::move(*panel));
+    }
+  }
+  return panels;
+}
+
+MultiPanelManager::MultiPanelManager(std::vector<ScreenManager>&& screens, size_t queue_capacity) {
+  for (auto& screen : screens) {
+    panels.push_back(std::make_unique<DisplayWorker>(std::move(screen), queue_capacity, QueueFullPolicy::Wait,
+                                                     [completions = completions.get()] {
+                                                       {
+                                                         std::lock_guard lock(completions->mutex);
+                                                         completions->generation++;
+                                                       }
+                                                       completions->changed.notify_all();
+                                                     }));
+  }
+}
+
+MultiPanelManager MultiPanelManager::open(const std::vector<std::string>& paths, size_t queue_capacity) {
+  std::vector<ScreenManager> screens;
+  for (const auto& path : paths) {
+    try {
+      screens.emplace_back(IT8951(ScsiDriver(path.c_str())));
+    } catch (const std::exception& e) {
+      log(LogLevel::Error, "Couldn't open panel {}: {}", path, e.what());
+    }
+  }
+  return MultiPanelManager(std::move(screens), queue_capacity);
+}
+
+std::vector<DisplayJobResult> MultiPanelManager::run_on_all(const PanelJob& job) {
+  std::lock_guard                      run_lock(*run_mutex);
+  std::vector<std::optional<uint64_t>> ids(panels.size());
+  std::vector<DisplayJobResult>        results(panels.size());
+  size_t                               outstanding = 0;
+  for (size_t panel = 0; panel < panels.size(); panel++) {
+    ids[panel] = panels[panel]->submit([&job, panel](ScreenManager& screen) { return job(panel, screen); });
+    if (ids[panel]) {
+      outstanding++;
+    } else {
+      results[panel] = {.status = DisplayJobResult::Status::Failed, .error = "Panel queue is full"};
+    }
+  }
+
+  std::unique_lock lock(completions->mutex);
+  while (outstanding > 0) {
+    const auto seen = completions->generation;
+    lock.unlock();
+    for (size_t panel = 0; panel < panels.size(); panel++) {
+      for (auto& result : panels[panel]->take_completions()) {
+        if (ids[panel] && result.id == *ids[panel]) {
+          results[panel] = std::move(result);
+          ids[panel].reset();
+          outstanding--;
+        }
+      }
+    }
+    lock.lock();
+    if (outstanding > 0) completions->changed.wait(lock, [&] { return completions->generation != seen; });
+  }
+  return results;
+}
+
+std::vector<DisplayJobResult> MultiPanelManager::display(const std::filesystem::path& path) {
+  return run_on_all([&path](size_t, ScreenManager& screen) { return screen.display(path); });
+}
+
+std::vector<DisplayJobResult> MultiPanelManager::display(const std::vector<std::filesystem::path>& paths) {
+  return run_on_all([&paths](size_t panel, ScreenManager& screen) {
+    return panel < paths.size() && !paths[panel].empty() ? screen.display(paths[panel]) : DisplayStats{};
+  });
+}
+
+std::vector<DisplayJobResult> MultiPanelManager::display_tiled(const cv::Mat& frame, uint32_t columns) {
+  columns           = std::clamp<uint32_t>(columns, 1, std::max<uint32_t>(static_cast<uint32_t>(panels.size()), 1));
+  const auto rows   = static_cast<uint32_t>((panels.size() + columns - 1) / columns);
+  const auto cell_w = frame.cols / static_cast<int>(columns);
+  const auto cell_h = rows ? frame.rows / static_cast<int>(rows) : 0;
+  return run_on_all([&](size_t panel, ScreenManager& screen) {
+    const cv::Rect cell(static_cast<int>(panel % columns) * cell_w, static_cast<int>(panel / columns) * cell_h, cell_w,
+                       cell_h);
+    return screen.display(frame(cell));
+  });
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "PanelImage.hpp"
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+#include "log.hpp"
+
+#ifdef WIN32
+#include <Windows.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+bool valid_header(const PanelImageHeader& header, size_t file_size) {
+  const PanelImageHeader expected{};
+  if (header.magic != expected.magic || header.version != expected.version) return false;
+  if (header.format != PixelFormat::Bpp1 && header.format != PixelFormat::Bpp2 &&
+      header.format != PixelFormat::Bpp4 && header.format != PixelFormat::Bpp8) {
+    return false;
+  }
+  // Sent to the controller as is, so only modes it knows
+  if (header.wavemode > WaveMode::A2) return false;
+  // Packed rows are loaded as bytes in the controller's 1bpp mode, which needs aligned areas
+  if (header.format == PixelFormat::Bpp1 && header.width % pixel_alignment(PixelFormat::Bpp1) != 0) return false;
+  const auto expected_row_bytes = header.format == PixelFormat::Bpp1 ? packed_row_bytes(header.width, header.format)
+                                                                     : static_cast<size_t>(header.width);
+  return header.row_bytes == expected_row_bytes && header.data_offset >= sizeof(PanelImageHeader) &&
+         header.data_offset + static_cast<uint64_t>(header.row_bytes) * header.height <= file_size;
+}
+}  // namespace
+
+std::optional<PanelImage> PanelImage::open(const std::filesystem::path& path) {
+  PanelImage image;
+#ifdef __linux__
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    log(LogLevel::Error, "Couldn't open panel image {}: {}", path.string(), strerror(errno));
+    return std::nullopt;
+  }
+  struct stat file_stat {};
+  if (fstat(fd, &file_stat) == 0 && static_cast<size_t>(file_stat.st_size) >= sizeof(PanelImageHeader)) {
+    image.size = static_cast<size_t>(file_stat.st_size);
+    void* mapping = mmap(nullptr, image.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      image.mapping = static_cast<const uint8_t*>(mapping);
+      // The whole file goes to the device in order right away
+      // The advice values aren't flags, each takes its own call
+      madvise(mapping, image.size, MADV_SEQUENTIAL);
+      madvise(mapping, image.size, MADV_WILLNEED);
+    }
+  }
+  close(fd);
+#endif
+#ifdef WIN32
+  HANDLE file = CreateFile(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    log(LogLevel::Error, "Couldn't open panel image {}: {}", path.string(), format_last_error(GetLastError()));
+    return std::nullopt;
+  }
+  LARGE_INTEGER file_size{};
+  if (GetFileSizeEx(file, &file_size) && static_cast<size_t>(file_size.QuadPart) >= sizeof(PanelImageHeader)) {
+    image.size         = static_cast<size_t>(file_size.QuadPart);
+    image.file_mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (image.file_mapping) {
+      image.mapping = static_cast<const uint8_t*>(MapViewOfFile(image.file_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+  }
+  CloseHandle(file);
+#endif
+  if (!image.mapping) {
+    log(LogLevel::Error, "Couldn't map panel image {}", path.string());
+    return std::nullopt;
+  }
+  if (!valid_header(image.header(), image.size)) {
+    log(LogLevel::Error, "{} isn't a valid panel image", path.string());
+    return std::nullopt;
+  }
+  return image;
+}
+
+PanelImage::PanelImage(PanelImage&& other) noexcept
+    : mapping(std::exchange(other.mapping, nullptr)), size(std::exchange(other.size, 0)) {
+#ifdef WIN32
+  file_mapping = std::exchange(other.file_mapping, nullptr);
+#endif
+}
+
+PanelImage& PanelImage::operator=(PanelImage&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    mapping = std::exchange(other.mapping, nullptr);
+    size    = std::exchange(other.size, 0);
+#ifdef WIN32
+    file_mapping = std::exchange(other.file_mapping, nullptr);
+#endif
+  }
+  return *this;
+}
+
+PanelImage::~PanelImage() { unmap(); }
+
+void PanelImage::unmap() {
+#ifdef __linux__
+  if (mapping) munmap(const_cast<uint8_t*>(mapping), size);
+#endif
+#ifdef WIN32
+  if (mapping) UnmapViewOfFile(mapping);
+  if (file_mapping) CloseHandle(file_mapping);
+  file_mapping = nullptr;
+#endif
+  mapping = nullptr;
+  size    = 0;
+}
+
+bool write_panel_image(const std::filesystem::path& path, const cv::Mat& frame, PixelFormat format, int rotation,
+                       WaveMode wavemode) {
+  if (frame.empty() || frame.type() != CV_8UC1) {
+    log(LogLevel::Error, "Panel images are written from 8bpp frames");
+    return false;
+  }
+  const auto width  = static_cast<uint32_t>(frame.cols);
+  const auto height = static_cast<uint32_t>(frame.rows);
+  // Same fallback as IT8951::load_image_area, unaligned 1bpp is sent as thresholded bytes
+  const auto stored_format = format == PixelFormat::Bpp1 && width % pixel_alignment(format) != 0 ? PixelFormat::Bpp8
+                                                                                                 : format;
+  const PanelImageHeader header{.width       = width,
+                                .height      = height,
+                                .rotation    = rotation,
+                                .format      = stored_format,
+                                .wavemode    = wavemode,
+                                .row_bytes   = static_cast<uint32_t>(stored_format == PixelFormat::Bpp1
+                                                                         ? packed_row_bytes(width, stored_format)
+                                                                         : width),
+                                .data_offset = panel_image_data_offset};
+  std::vector<uint8_t> rows(static_cast<size_t>(header.row_bytes) * height);
+  const auto           pixels = std::span(frame.data, frame.step[0] * (height - 1) + width);
+  if (stored_format == PixelFormat::Bpp1) {
+    pack_pixels(pixels, frame.step[0], width, height, stored_format, rows);
+  } else {
+    // Requantizing is a no-op for frames already at format's levels, and thresholds an unaligned 1bpp frame
+    quantize_pixels(pixels, frame.step[0], width, height, format, rows);
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  std::array<char, panel_image_data_offset> prefix{};
+  std::memcpy(prefix.data(), &header, sizeof(header));
+  out.write(prefix.data(), prefix.size());
+  out.write(reinterpret_cast<const char*>(rows.data()), static_cast<std::streamsize>(rows.size()));
+  if (!out) {
+    log(LogLevel::Error, "Couldn't write panel image {}", path.string());
+    return false;
+  }
+  return true;
+}
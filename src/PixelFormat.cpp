@@ -0,0 +1,107 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "PixelFormat.hpp"
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+// Maps a source gray value to its quantized level, tone map included
+std::array<uint8_t, 256> make_level_table(PixelFormat format, const ToneMap* tone_map) {
+  std::array<uint8_t, 256> table{};
+  const auto shift = 8 - bits_per_pixel(format);
+  for (size_t v = 0; v < table.size(); v++) {
+    const uint8_t toned = tone_map ? (*tone_map)[v] : static_cast<uint8_t>(v);
+    table[v] = static_cast<uint8_t>(toned >> shift);
+  }
+  return table;
+}
+
+// Handles the pixels the SIMD kernels leave over, x is where they stopped
+void pack_row_scalar(const uint8_t* src, uint32_t x, uint32_t width, PixelFormat format,
+                     uint8_t* dst, const std::array<uint8_t, 256>& levels) {
+  const auto bits           = bits_per_pixel(format);
+  const auto pixels_in_byte = 8 / bits;
+  for (; x < width; x += pixels_in_byte) {
+    uint8_t packed = 0;
+    for (uint32_t i = 0; i < pixels_in_byte && x + i < width; i++) {
+      packed |= static_cast<uint8_t>(levels[src[x + i]] << (i * bits));
+    }
+    dst[x / pixels_in_byte] = packed;
+  }
+}
+
+uint32_t pack_row_simd(const uint8_t* src, uint32_t width, PixelFormat format, uint8_t* dst) {
+  uint32_t x = 0;
+#if defined(__SSE2__)
+  if (format == PixelFormat::Bpp1) {
+    // movemask collects the top bit of every byte, which is exactly a threshold at 128
+    for (; x + 16 <= width; x += 16) {
+      const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+      const auto mask   = static_cast<uint16_t>(_mm_movemask_epi8(pixels));
+      std::memcpy(dst + x / 8, &mask, sizeof(mask));
+    }
+  } else if (format == PixelFormat::Bpp4) {
+    const auto even_mask = _mm_set1_epi16(0x00F0);
+    const auto odd_mask  = _mm_set1_epi16(static_cast<short>(0xF000));
+    for (; x + 16 <= width; x += 16) {
+      const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+      const auto even   = _mm_srli_epi16(_mm_and_si128(pixels, even_mask), 4);
+      const auto odd    = _mm_srli_epi16(_mm_and_si128(pixels, odd_mask), 8);
+      const auto packed = _mm_packus_epi16(_mm_or_si128(even, odd), _mm_setzero_si128());
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x / 2), packed);
+    }
+  }
+#endif
+  return x;
+}
+}  // namespace
+
+void pack_pixels(std::span<const uint8_t> src, size_t src_stride, uint32_t width,
+                 uint32_t height, PixelFormat format, std::span<uint8_t> dst,
+                 const ToneMap* tone_map) {
+  const auto row_bytes = packed_row_bytes(width, format);
+  assert(dst.size() >= row_bytes * height);
+  assert(height == 0 || src.size() >= src_stride * (height - 1) + width);
+  if (format == PixelFormat::Bpp8) {
+    quantize_pixels(src, src_stride, width, height, format, dst, tone_map);
+    return;
+  }
+  const auto levels = make_level_table(format, tone_map);
+  for (uint32_t y = 0; y < height; y++) {
+    const auto* src_row = src.data() + y * src_stride;
+    auto*       dst_row = dst.data() + y * row_bytes;
+    const auto  done    = tone_map ? 0 : pack_row_simd(src_row, width, format, dst_row);
+    pack_row_scalar(src_row, done, width, format, dst_row, levels);
+  }
+}
+
+void quantize_pixels(std::span<const uint8_t> src, size_t src_stride, uint32_t width,
+                     uint32_t height, PixelFormat format, std::span<uint8_t> dst,
+                     const ToneMap* tone_map) {
+  assert(dst.size() >= static_cast<size_t>(width) * height);
+  if (format == PixelFormat::Bpp8 && !tone_map) {
+    for (uint32_t y = 0; y < height; y++) {
+      std::memcpy(dst.data() + y * width, src.data() + y * src_stride, width);
+    }
+    return;
+  }
+  const auto table = quantization_table(format, tone_map);
+  for (uint32_t y = 0; y < height; y++) {
+    const auto* src_row = src.data() + y * src_stride;
+    auto*       dst_row = dst.data() + y * width;
+    for (uint32_t x = 0; x < width; x++) dst_row[x] = table[src_row[x]];
+  }
+}
+
+std::array<uint8_t, 256> quantization_table(PixelFormat format, const ToneMap* tone_map) {
+  const auto max_level = (1u << bits_per_pixel(format)) - 1;
+  auto       table     = make_level_table(format, tone_map);
+  for (auto& level : table) level = static_cast<uint8_t>(level * 255 / max_level);
+  return table;
+}
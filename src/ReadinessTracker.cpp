@@ -0,0 +1,141 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "ReadinessTracker.hpp"
+#include <algorithm>
+#include "log.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+// Frames assumed when the controller didn't report a count for a mode
+constexpr uint32_t default_frame_count = 30;
+// Rough cost of the controller preparing the update per pixel before the waveform starts
+constexpr double pixel_time_ns = 10;
+// Status is read this long before the predicted end, so the real end can be measured
+constexpr auto early_poll_margin = 20ms;
+constexpr auto max_poll_interval = 16ms;
+// Waiting gives up this long after the predicted end
+constexpr auto timeout_slack = 2s;
+}  // namespace
+
+ReadinessTracker::ReadinessTracker(StatusReader reader) : reader(std::move(reader)) {}
+
+ReadinessTracker::~ReadinessTracker() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  waiters_changed.notify_all();
+  if (worker.joinable()) worker.join();
+  for (auto& waiter : waiters) waiter.promise.set_value(false);
+}
+
+void ReadinessTracker::set_reader(StatusReader new_reader) {
+  std::lock_guard lock(mutex);
+  reader = std::move(new_reader);
+}
+
+void ReadinessTracker::set_frame_counts(std::span<const unsigned int, 8> counts) {
+  std::lock_guard lock(mutex);
+  std::copy(counts.begin(), counts.end(), frame_counts.begin());
+}
+
+void ReadinessTracker::refresh_started(WaveMode mode, uint64_t pixels) {
+  std::lock_guard lock(mutex);
+  const auto now    = Clock::now();
+  const auto index  = static_cast<size_t>(mode) % frame_counts.size();
+  const auto frames = frame_counts[index] ? frame_counts[index] : default_frame_count;
+  const auto duration = std::chrono::duration<double, std::milli>(
+      frames * frame_time_ms + static_cast<double>(pixels) * pixel_time_ns / 1e6);
+  if (busy_until <= now) {
+    busy_since  = now;
+    busy_frames = 0;
+  }
+  busy_frames += frames;
+  busy_until = std::max(busy_until, now + std::chrono::duration_cast<Clock::duration>(duration));
+  log(LogLevel::Debug, "Refresh of {} frames, predicted ready in {:.1f}ms", frames, duration.count());
+}
+
+ReadinessTracker::Clock::time_point ReadinessTracker::predicted_ready() const {
+  std::lock_guard lock(mutex);
+  return busy_until;
+}
+
+std::chrono::duration<double, std::milli> ReadinessTracker::frame_time() const {
+  std::lock_guard lock(mutex);
+  return std::chrono::duration<double, std::milli>(frame_time_ms);
+}
+
+bool ReadinessTracker::wait_until_ready() {
+  std::unique_lock lock(mutex);
+  const auto start     = Clock::now();
+  const auto predicted = busy_until;
+  const auto since     = busy_since;
+  const auto frames    = busy_frames;
+  const auto read      = reader;
+  lock.unlock();
+
+  if (predicted > start + early_poll_margin) {
+    std::this_thread::sleep_until(predicted - early_poll_margin);
+  }
+  const auto deadline = std::max(predicted, start) + timeout_slack;
+  auto       interval = Clock::duration(1ms);
+  bool       was_busy = false;
+  while (true) {
+    const auto status = read ? read() : std::nullopt;
+    const auto now    = Clock::now();
+    if (!status) {
+      log(LogLevel::Error, "Couldn't read the controller status");
+      return false;
+    }
+    if ((*status & 0xFFFF) == 0) {
+      lock.lock();
+      // Seeing it busy first means the end lies between the last two reads, close enough to learn from
+      if (was_busy && frames > 0 && busy_until == predicted) {
+        const auto measured = std::chrono::duration<double, std::milli>(now - since).count() / frames;
+        frame_time_ms       = std::clamp(0.8 * frame_time_ms + 0.2 * measured, 5.0, 100.0);
+        log(LogLevel::Debug, "Refresh took {:.1f}ms per frame, now assuming {:.1f}ms", measured,
+            frame_time_ms);
+      }
+      if (busy_until == predicted) busy_until = std::min(busy_until, now);
+      return true;
+    }
+    if (now > deadline) {
+      log(LogLevel::Warning, "Controller still busy {}ms after the predicted end",
+          std::chrono::duration_cast<std::chrono::milliseconds>(now - predicted).count());
+      return false;
+    }
+    was_busy = true;
+    std::this_thread::sleep_for(interval);
+    interval = std::min<Clock::duration>(interval * 2, max_poll_interval);
+  }
+}
+
+std::future<bool> ReadinessTracker::when_ready(std::function<void(bool)> callback) {
+  std::lock_guard lock(mutex);
+  auto&           waiter = waiters.emplace_back(Waiter{.promise = {}, .callback = std::move(callback)});
+  auto            future = waiter.promise.get_future();
+  if (!worker.joinable()) worker = std::thread(&ReadinessTracker::run_worker, this);
+  waiters_changed.notify_one();
+  return future;
+}
+
+void ReadinessTracker::run_worker() {
+  std::unique_lock lock(mutex);
+  while (true) {
+    waiters_changed.wait(lock, [this] { return stopping || !waiters.empty(); });
+    if (stopping) return;
+    // Waiters arriving during this wait may be waiting for a later refresh, they get the next round
+    auto done = std::move(waiters);
+    waiters.clear();
+    lock.unlock();
+    const bool ready = wait_until_ready();
+    for (auto& waiter : done) {
+      if (waiter.callback) waiter.callback(ready);
+      waiter.promise.set_value(ready);
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "RefreshScheduler.hpp"
+#include <algorithm>
+
+namespace {
+// Higher wins when updates with different waveforms are merged
+int waveform_quality(WaveMode mode) {
+  switch (mode) {
+    case WaveMode::A2: return 0;
+    case WaveMode::DU: return 1;
+    case WaveMode::DU4: return 2;
+    case WaveMode::GL16:
+    case WaveMode::GLR16:
+    case WaveMode::GLD16: return 3;
+    case WaveMode::GC16: return 4;
+    case WaveMode::Init: return 5;
+  }
+  return 4;
+}
+
+bool near(const IT8951Area& a, const IT8951Area& b, uint32_t distance) {
+  return a.x <= b.x + b.w + distance && b.x <= a.x + a.w + distance &&
+         a.y <= b.y + b.h + distance && b.y <= a.y + a.h + distance;
+}
+
+IT8951Area unite(const IT8951Area& a, const IT8951Area& b) {
+  const auto x = std::min(a.x, b.x);
+  const auto y = std::min(a.y, b.y);
+  return {.x = x,
+          .y = y,
+          .w = std::max(a.x + a.w, b.x + b.w) - x,
+          .h = std::max(a.y + a.h, b.y + b.h) - y};
+}
+}  // namespace
+
+void RefreshScheduler::add(const IT8951Area& area, WaveMode wavemode, Clock::time_point now) {
+  ScheduledUpdate merged{.area = area, .wavemode = wavemode, .queued = now};
+  // A merged rectangle can touch ones it didn't before, so keep going until nothing changes
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto it = updates.begin(); it != updates.end(); ++it) {
+      if (!near(it->area, merged.area, policy.merge_distance)) continue;
+      merged.area = unite(it->area, merged.area);
+      if (waveform_quality(it->wavemode) > waveform_quality(merged.wavemode)) {
+        merged.wavemode = it->wavemode;
+      }
+      merged.queued = std::min(merged.queued, it->queued);
+      updates.erase(it);
+      changed = true;
+      break;
+    }
+  }
+  updates.push_back(merged);
+}
+
+bool RefreshScheduler::due(Clock::time_point controller_ready, Clock::time_point now) const {
+  if (updates.empty()) return false;
+  if (now >= controller_ready) return true;
+  const auto oldest = std::min_element(updates.begin(), updates.end(), [](const auto& a, const auto& b) {
+    return a.queued < b.queued;
+  });
+  return now - oldest->queued >= policy.latency_budget;
+}
+
+std::optional<RefreshScheduler::Clock::time_point> RefreshScheduler::due_at(Clock::time_point controller_ready) const {
+  if (updates.empty()) return std::nullopt;
+  const auto oldest = std::min_element(updates.begin(), updates.end(), [](const auto& a, const auto& b) {
+    return a.queued < b.queued;
+  });
+  return std::min(controller_ready, oldest->queued + policy.latency_budget);
+}
+
+RefreshScheduler::Batch RefreshScheduler::take() {
+  Batch batch{.updates = std::move(updates), .full_refresh = false};
+  updates.clear();
+  partial_updates += batch.updates.size();
+  if (policy.full_refresh_interval > 0 && partial_updates >= policy.full_refresh_interval) {
+    batch.full_refresh = true;
+    partial_updates    = 0;
+  }
+  return batch;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "ResidentImageCache.hpp"
+#include <bit>
+#include <cstring>
+#include "log.hpp"
+
+namespace {
+uint64_t mix(uint64_t hash, uint64_t value) {
+  return std::rotl(hash ^ value * 0x9E3779B97F4A7C15ull, 31) * 0xBF58476D1CE4E5B9ull;
+}
+
+// Different constants and structure than mix, so inputs colliding in one are unrelated in the other
+uint64_t mix_verifier(uint64_t hash, uint64_t value) {
+  return std::rotl(hash + (value ^ 0xC2B2AE3D27D4EB4Full) * 0x94D049BB133111EBull, 27) * 0x165667B19E3779F9ull;
+}
+}  // namespace
+
+ResidentImageKey ResidentImageKey::for_pixels(std::span<const uint8_t> pixels, size_t stride, uint32_t width,
+                                              uint32_t height, PixelFormat format) {
+  // Eight bytes at a time, a panel frame is hashed in well under a millisecond
+  uint64_t hash     = mix(static_cast<uint64_t>(width) << 32 | height, static_cast<uint64_t>(format));
+  uint64_t verifier = mix_verifier(static_cast<uint64_t>(height) << 32 | width, static_cast<uint64_t>(format));
+  for (uint32_t row = 0; row < height; row++) {
+    const auto* data = pixels.data() + row * stride;
+    uint32_t    col  = 0;
+    for (; col + 8 <= width; col += 8) {
+      uint64_t value;
+      std::memcpy(&value, data + col, sizeof(value));
+      hash     = mix(hash, value);
+      verifier = mix_verifier(verifier, value);
+    }
+    if (col < width) {
+      uint64_t value = 0;
+      std::memcpy(&value, data + col, width - col);
+      hash     = mix(hash, value);
+      verifier = mix_verifier(verifier, value);
+    }
+  }
+  return {.hash     = hash ^ hash >> 29,
+          .verifier = verifier ^ verifier >> 32,
+          .width    = width,
+          .height   = height,
+          .format   = format};
+}
+
+void ResidentImageCache::configure(uint32_t new_base, uint32_t new_slot_bytes, uint32_t count) {
+  clear();
+  base       = new_base;
+  slot_bytes = new_slot_bytes;
+  slots.clear();
+  free_slots.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    slots.push_back({.address = base + i * slot_bytes});
+    // Handed out from the back, so the lowest addresses are used first
+    free_slots.push_back(count - 1 - i);
+  }
+}
+
+ResidentImage* ResidentImageCache::find(const ResidentImageKey& key) {
+  const auto found = index.find(key);
+  if (found == index.end()) {
+    misses++;
+    return nullptr;
+  }
+  hits++;
+  entries.splice(entries.begin(), entries, found->second);
+  return &found->second->second;
+}
+
+ResidentImage* ResidentImageCache::insert(const ResidentImageKey& key) {
+  if (slots.empty()) return nullptr;
+  erase(key);
+  if (free_slots.empty()) {
+    log(LogLevel::Debug, "Evicting resident image at {:#x}", entries.back().second.address);
+    release(std::prev(entries.end()));
+    evictions++;
+  }
+  const auto slot = free_slots.back();
+  free_slots.pop_back();
+  entries.emplace_front(key, slots[slot]);
+  index.emplace(key, entries.begin());
+  return &entries.front().second;
+}
+
+void ResidentImageCache::erase(const ResidentImageKey& key) {
+  if (const auto found = index.find(key); found != index.end()) release(found->second);
+}
+
+void ResidentImageCache::clear() {
+  while (!entries.empty()) release(entries.begin());
+}
+
+ResidentImageCacheStats ResidentImageCache::stats() const {
+  return {.hits      = hits,
+          .misses    = misses,
+          .evictions = evictions,
+          .resident  = static_cast<uint32_t>(entries.size()),
+          .slots     = slot_count()};
+}
+
+void ResidentImageCache::release(std::list<Entry>::iterator entry) {
+  const auto slot = (entry->second.address - base) / slot_bytes;
+  // The slot remembers when the panel stops reading it, for whoever gets it next
+  slots[slot] = entry->second;
+  free_slots.push_back(slot);
+  index.erase(entry->first);
+  entries.erase(entry);
+}
@@ -3,76 +3,385 @@
  * SPDX-License-Identifier: Apache-2.0
 */
 #include "ScreenManager.hpp"
+#include <algorithm>
 #include <thread>
+#include "ImageDecode.hpp"
+#include "PanelImage.hpp"
 #include "log.hpp"
 
 ScreenManager::ScreenManager(IT8951&& it)
     : it(std::forward<IT8951&&>(it)),
-      info(this->it.get_system_info().value_or<IT8951SystemInfo>({})) {
+      info(this->it.get_system_info().value_or<IT8951SystemInfo>({})),
+      arena(std::make_unique<FrameArena>(FrameArena::bytes_for_panel(info.uiWidth, info.uiHeight))) {
   log(LogLevel::Debug, "Created screen manager for screen {}x{}", info.uiWidth,
       info.uiHeight);
-  log(LogLevel::Error, "Info: {}",
+  log(LogLevel::Debug, "Info: {}",
       fmt::join(std::span<uint32_t>((uint32_t*)&info, 28), ", "));
+  set_image_buffer_count(1);
 }
 ScreenManager::ScreenManager(IT8951&& it, double vcom)
     : ScreenManager(std::forward<IT8951&&>(it)) {
   it.set_vcom(vcom);
 }
 
-std::optional<Mat> ScreenManager::load_image(const std::filesystem::path& image_path) {
+std::optional<Mat> ScreenManager::load_image(const std::filesystem::path& image_path) const {
   const auto imgpath = image_path.string();
   log(LogLevel::Info, "Trying to load {}", imgpath);
-  Mat img = imread(imgpath, IMREAD_GRAYSCALE);
+  // Large JPEGs are decoded at a fraction of their size, only what the panel can show
+  DecodeTimings timings;
+  Mat           img = decode_for_panel(image_path, rotation, info.uiWidth, info.uiHeight, &timings);
   if (img.empty()) {
     log(LogLevel::Error, "Image is empty\n");
     return std::nullopt;
   }
-  log(LogLevel::Info, "Opened image, size: {}x{} ({}bpp)", img.cols, img.rows,
-      img.elemSize());
+  log(LogLevel::Info, "Opened image, size: {}x{} ({}bpp) at 1/{} scale", img.cols, img.rows, img.elemSize(),
+      timings.factor);
+  log(LogLevel::Debug, "Reading the header took {} us, decoding {} us",
+      std::chrono::duration_cast<std::chrono::microseconds>(timings.header).count(),
+      std::chrono::duration_cast<std::chrono::microseconds>(timings.decode).count());
   return img;
 }
 
-Mat ScreenManager::scale_image_to_display(const Mat& img) const {
-  Mat resized_down = img;
-  log(LogLevel::Info, "Resizing image from {}x{} to {}x{}", img.cols, img.rows, info.uiWidth, info.uiHeight);
-  resize(resized_down, resized_down, Size(info.uiWidth, info.uiHeight));
-  return resized_down;
+Mat ScreenManager::render_to_display(const Mat& img) {
+  log(LogLevel::Info, "Rotating image {} and resizing from {}x{} to {}x{}", rotation, img.cols, img.rows,
+      info.uiWidth, info.uiHeight);
+  const auto scope = arena->scope();
+  frame_buffer.resize(static_cast<size_t>(info.uiWidth) * info.uiHeight);
+  // Dithering needs the full 8 bit values, it quantizes afterwards
+  const auto format = dither_mode == DitherMode::None ? pixel_format : PixelFormat::Bpp8;
+  render_to_panel(img, rotation, info.uiWidth, info.uiHeight,
+                  quantization_table(format, tone_map ? &*tone_map : nullptr), frame_buffer, arena->resource());
+  Mat frame(static_cast<int>(info.uiHeight), static_cast<int>(info.uiWidth), CV_8UC1, frame_buffer.data());
+  dither(frame, pixel_format, dither_mode, 0, arena->resource(), dither_pool.get());
+  return frame;
 }
 
-void ScreenManager::display_image(const Mat& img, const IT8951DisplayArea& area) {
-  // it.wait_until_ready(); // doesn't work on linux
-  it.load_image_area({.address = area.address, .area = area.area},
-                     std::span(img.data, img.size().area()));
-    it.display_image_area(area);
-    if(cleared){
-        it.display_image_area(area);
-        cleared = false;
+void ScreenManager::quantize_into(const Mat& src, Mat& dst) {
+  const auto format       = dither_mode == DitherMode::None ? pixel_format : PixelFormat::Bpp8;
+  const auto quantization = quantization_table(format, tone_map ? &*tone_map : nullptr);
+  for (int row = 0; row < src.rows; row++) {
+    const auto* src_row = src.ptr<uint8_t>(row);
+    auto*       dst_row = dst.ptr<uint8_t>(row);
+    for (int col = 0; col < src.cols; col++) dst_row[col] = quantization[src_row[col]];
+  }
+  const auto scope = arena->scope();
+  dither(dst, pixel_format, dither_mode, 0, arena->resource(), dither_pool.get());
+}
+
+DisplayStats ScreenManager::display_image(const Mat& img, const IT8951DisplayArea& area, bool full) {
+  const Rect target(static_cast<int>(area.area.x), static_cast<int>(area.area.y),
+                    static_cast<int>(area.area.w), static_cast<int>(area.area.h));
+  const auto scope = arena->scope();
+  if (shadow.empty()) {
+    shadow = Mat(static_cast<int>(info.uiHeight), static_cast<int>(info.uiWidth), CV_8UC1, Scalar(0xFF));
+  }
+  const bool target_known = shadow_known(target);
+  const auto dirty_areas =
+      full || cleared || !target_known
+          ? std::pmr::vector<IT8951Area>({{.x = 0, .y = 0, .w = area.area.w, .h = area.area.h}}, arena->resource())
+          : find_dirty_areas(shadow(target), img, dirty_tile_size, max_dirty_regions, arena->resource());
+
+  if (!dirty_areas.empty() && !back_buffer_used &&
+      ReadinessTracker::Clock::now() < buffer_busy_until[back_buffer]) {
+    // The panel may still be refreshing from the buffer we're about to overwrite
+    it.wait_until_ready();
+  }
+
+  DisplayStats stats{};
+  const auto   alignment = pixel_alignment(pixel_format);
+  for (auto dirty : dirty_areas) {
+    if (alignment > 1) {
+      // Grow the area to the format's alignment in panel coordinates, staying inside the target
+      const auto left  = (area.area.x + dirty.x) / alignment * alignment;
+      const auto right = (area.area.x + dirty.x + dirty.w + alignment - 1) / alignment * alignment;
+      dirty.x          = std::max(left, area.area.x) - area.area.x;
+      dirty.w          = std::min(right, area.area.x + area.area.w) - area.area.x - dirty.x;
+    }
+    const Mat region = img(Rect(static_cast<int>(dirty.x), static_cast<int>(dirty.y),
+                                static_cast<int>(dirty.w), static_cast<int>(dirty.h)));
+    const IT8951Area panel_area{.x = area.area.x + dirty.x, .y = area.area.y + dirty.y, .w = dirty.w, .h = dirty.h};
+    // Without knowing what the panel shows a fast waveform could leave unknown gray content behind
+    const auto wavemode =
+        auto_waveform && target_known
+            ? select_waveform(region, shadow(Rect(static_cast<int>(panel_area.x), static_cast<int>(panel_area.y),
+                                                  static_cast<int>(panel_area.w), static_cast<int>(panel_area.h))))
+            : area.wavemode;
+    const IT8951DisplayArea dirty_area{.address    = area.address,
+                                       .wavemode   = wavemode,
+                                       .area       = panel_area,
+                                       .wait_ready = area.wait_ready};
+    if (it.load_image_area({.address = dirty_area.address, .area = dirty_area.area},
+                           std::span(region.data, img.step[0] * (dirty.h - 1) + dirty.w), img.step[0],
+                           pixel_format, nullptr, arena->resource())) {
+      // Per region, whether 1bpp is sent packed depends on its alignment
+      stats.bytes_sent += IT8951::transfer_bytes(panel_area, pixel_format);
     }
+    it.display_image_area(dirty_area);
+    if (cleared) {
+      it.display_image_area(dirty_area);
+    }
+    stats.area_updated += static_cast<uint64_t>(dirty.w) * dirty.h;
+    stats.regions++;
+  }
+  cleared = false;
+  back_buffer_used |= stats.regions > 0;
+
+  Mat shadow_target = shadow(target);
+  img.copyTo(shadow_target);
+  // Only one known rectangle is tracked, keep the larger one
+  if (!target_known && target.area() >= shadow_area.area()) shadow_area = target;
+
+  const uint64_t target_area = static_cast<uint64_t>(area.area.w) * area.area.h;
+  stats.area_skipped = target_area - std::min(stats.area_updated, target_area);
+  // At the rate uploading the whole target would have cost
+  stats.bytes_skipped =
+      target_area == 0 ? 0 : IT8951::transfer_bytes(area.area, pixel_format) * stats.area_skipped / target_area;
+  log(LogLevel::Debug, "Updated {} regions, sent {} bytes, skipped {} bytes", stats.regions,
+      stats.bytes_sent, stats.bytes_skipped);
+  return stats;
+}
+
+DisplayStats ScreenManager::display(const std::filesystem::path& path) {
+  if (path.extension() == panel_image_extension) {
+    const auto image = PanelImage::open(path);
+    if (!image) return {};
+    return display_prepared(*image);
+  }
+  const auto key    = FrameKey::for_file(path, rotation, info.uiWidth, info.uiHeight);
+  auto       cached = key ? frame_cache.find(*key) : nullptr;
+  Mat        scaled_img;
+  if (cached) {
+    log(LogLevel::Debug, "Using cached frame for {}", path.string());
+    scaled_img = Mat(static_cast<int>(info.uiHeight), static_cast<int>(info.uiWidth), CV_8UC1,
+                     const_cast<uint8_t*>(cached->data()));
+  } else {
+    const auto img = load_image(path);
+    if (!img.has_value()) {
+      log(LogLevel::Warning, "Couldn't load image {}", path.string());
+      return {};
+    }
+    scaled_img = render_to_display(*img);
+    if (key && frame_cache.get_max_bytes() > 0) cached = frame_cache.insert(*key, frame_buffer);
+  }
+  return display_frame(scaled_img, WaveMode::GC16, true);
+}
+
+DisplayStats ScreenManager::display(const Mat& img) {
+  if (img.empty()) {
+    log(LogLevel::Warning, "Not displaying an empty image");
+    return {};
+  }
+  return display_frame(render_to_display(img), WaveMode::GC16, true);
+}
+
+DisplayStats ScreenManager::display_rendered(const Mat& frame, WaveMode wavemode) {
+  if (frame.empty() || frame.type() != CV_8UC1 || static_cast<uint32_t>(frame.cols) > info.uiWidth ||
+      static_cast<uint32_t>(frame.rows) > info.uiHeight) {
+    log(LogLevel::Warning, "Rendered frame of {}x{} doesn't fit the panel", frame.cols, frame.rows);
+    return {};
+  }
+  return display_frame(frame, wavemode);
 }
 
-void ScreenManager::display(const std::filesystem::path& path) {
-  const auto img = load_image(path);
-  if (!img.has_value()) {
-    log(LogLevel::Warning, "Couldn't load image {}", path.string());
-    return;
+DisplayStats ScreenManager::display_frame(const Mat& scaled_img, WaveMode wavemode, bool keep_resident) {
+  if (!scheduler.empty()) {
+    log(LogLevel::Debug, "Dropping queued region updates, a full image replaces them");
+    scheduler.clear();
   }
-  Mat rotated;
-  cv::rotate(*img, rotated, rotation);
-  log(LogLevel::Info, "Rotating image {}", rotation);
-  const auto scaled_img = scale_image_to_display(rotated);
-  display_image(scaled_img, {.address    = info.uiImageBufBase,
-                             .wavemode   = WaveMode::GC16,
-                             .area       = {.x = (info.uiWidth - scaled_img.cols) / 2,
-                                            .y = (info.uiHeight - scaled_img.rows) / 2,
-                                            .w = static_cast<uint32_t>(scaled_img.cols),
-                                            .h = static_cast<uint32_t>(scaled_img.rows)},
-                             .wait_ready = 0});
+  if (keep_resident && resident_images.slot_count() > 0) return display_resident(scaled_img, wavemode);
+  const auto stats = display_image(scaled_img, {.address    = image_buffer_address(back_buffer),
+                                                .wavemode   = wavemode,
+                                                .area       = {.x = (info.uiWidth - scaled_img.cols) / 2,
+                                                               .y = (info.uiHeight - scaled_img.rows) / 2,
+                                                               .w = static_cast<uint32_t>(scaled_img.cols),
+                                                               .h = static_cast<uint32_t>(scaled_img.rows)},
+                                                .wait_ready = 0});
+  finish_frame();
+  return stats;
+}
+
+DisplayStats ScreenManager::display_prepared(const PanelImage& image) {
+  const auto& header = image.header();
+  if (header.width > info.uiWidth || header.height > info.uiHeight) {
+    log(LogLevel::Warning, "Panel image of {}x{} doesn't fit the {}x{} panel", header.width, header.height,
+        info.uiWidth, info.uiHeight);
+    return {};
+  }
+  if (header.rotation != rotation) {
+    log(LogLevel::Warning, "Panel image was rendered with rotation {}, the screen uses {}", header.rotation,
+        rotation);
+  }
+  if (!scheduler.empty()) {
+    log(LogLevel::Debug, "Dropping queued region updates, a full image replaces them");
+    scheduler.clear();
+  }
+  if (ReadinessTracker::Clock::now() < buffer_busy_until[back_buffer]) it.wait_until_ready();
+
+  // Packed rows are loaded at byte offsets, so a 1bpp image is centred on the format's alignment
+  const uint32_t alignment = header.format == PixelFormat::Bpp1 ? pixel_alignment(PixelFormat::Bpp1) : 1;
+  const IT8951DisplayArea area{.address    = image_buffer_address(back_buffer),
+                               .wavemode   = header.wavemode,
+                               .area       = {.x = (info.uiWidth - header.width) / 2 / alignment * alignment,
+                                              .y = (info.uiHeight - header.height) / 2,
+                                              .w = header.width,
+                                              .h = header.height},
+                               .wait_ready = 0};
+  // Rows go to the device straight from the mapping
+  if (!it.load_prepared_image_area({.address = area.address, .area = area.area}, image.rows(), header.format)) {
+    log(LogLevel::Warning, "Couldn't load the panel image, not displaying it");
+    // Part of it may have reached the buffer later updates build on
+    shadow_area = {};
+    return {};
+  }
+  it.display_image_area(area);
+  if (cleared) it.display_image_area(area);
+  cleared          = false;
+  back_buffer_used = true;
+  // The pixels never pass through here, so nothing is known about what the panel shows
+  shadow_area = {};
+  finish_frame();
+
+  DisplayStats stats{};
+  stats.regions      = 1;
+  stats.area_updated = static_cast<uint64_t>(header.width) * header.height;
+  stats.bytes_sent   = image.rows().size();
+  return stats;
+}
+
+DisplayStats ScreenManager::display_resident(const Mat& frame, WaveMode wavemode) {
+  const auto pixels = std::span(frame.data, frame.step[0] * (frame.rows - 1) + frame.cols);
+  const auto key    = ResidentImageKey::for_pixels(pixels, frame.step[0], frame.cols, frame.rows, pixel_format);
+  const IT8951Area area{.x = (info.uiWidth - frame.cols) / 2,
+                        .y = (info.uiHeight - frame.rows) / 2,
+                        .w = static_cast<uint32_t>(frame.cols),
+                        .h = static_cast<uint32_t>(frame.rows)};
+  const Rect       target(static_cast<int>(area.x), static_cast<int>(area.y), frame.cols, frame.rows);
+  const auto       scope = arena->scope();
+  if (shadow.empty()) {
+    shadow = Mat(static_cast<int>(info.uiHeight), static_cast<int>(info.uiWidth), CV_8UC1, Scalar(0xFF));
+  }
+
+  const uint64_t frame_bytes = IT8951::transfer_bytes(area, pixel_format);
+  DisplayStats   stats{.area_updated = static_cast<uint64_t>(area.w) * area.h, .regions = 1};
+  auto*          resident = resident_images.find(key);
+  if (resident) {
+    log(LogLevel::Debug, "Showing resident image from {:#x}", resident->address);
+    stats.bytes_skipped = frame_bytes;
+    it.set_1bpp_mode(IT8951::loads_packed(area, pixel_format));
+  } else {
+    resident = resident_images.insert(key);
+    if (ReadinessTracker::Clock::now() < resident->busy_until) {
+      // The slot's previous image may still be on its way to the panel
+      it.wait_until_ready();
+    }
+    if (!it.load_image_area({.address = resident->address, .area = area}, pixels, frame.step[0], pixel_format,
+                            nullptr, arena->resource())) {
+      // Whatever made it into the slot isn't the image, it mustn't be shown as a hit later
+      log(LogLevel::Warning, "Uploading resident image to {:#x} failed", resident->address);
+      resident_images.erase(key);
+      return {};
+    }
+    stats.bytes_sent = frame_bytes;
+  }
+
+  const IT8951DisplayArea display_area{
+      .address    = resident->address,
+      .wavemode   = auto_waveform && shadow_known(target) ? select_waveform(frame, shadow(target)) : wavemode,
+      .area       = area,
+      .wait_ready = 0};
+  it.display_image_area(display_area);
+  if (cleared) it.display_image_area(display_area);
+  cleared              = false;
+  resident->busy_until = it.predicted_ready();
+
+  Mat shadow_target = shadow(target);
+  frame.copyTo(shadow_target);
+  if (target.area() >= shadow_area.area()) shadow_area = target;
+  return stats;
+}
+
+DisplayStats ScreenManager::update_region(const Mat& img, uint32_t x, uint32_t y, WaveMode wavemode) {
+  if (!queue_region(img, x, y, wavemode)) return {};
+  return flush_if_due();
+}
+
+DisplayStats ScreenManager::display_region(const Mat& img, uint32_t x, uint32_t y, WaveMode wavemode) {
+  if (!queue_region(img, x, y, wavemode)) return {};
+  return flush();
+}
+
+bool ScreenManager::queue_region(const Mat& img, uint32_t x, uint32_t y, WaveMode wavemode) {
+  if (x >= info.uiWidth || y >= info.uiHeight) {
+    log(LogLevel::Warning, "Region at {},{} is outside the panel", x, y);
+    return false;
+  }
+  if (scheduler.empty()) {
+    if (shadow.empty()) {
+      shadow = Mat(static_cast<int>(info.uiHeight), static_cast<int>(info.uiWidth), CV_8UC1, Scalar(0xFF));
+    }
+    shadow.copyTo(pending_frame);
+  }
+  const auto w = std::min<uint32_t>(img.cols, info.uiWidth - x);
+  const auto h = std::min<uint32_t>(img.rows, info.uiHeight - y);
+  const Rect source(0, 0, static_cast<int>(w), static_cast<int>(h));
+  Mat        destination = pending_frame(Rect(static_cast<int>(x), static_cast<int>(y), source.width, source.height));
+  // Quantized on the way in, like display does, so the shadow holds what the panel shows
+  quantize_into(img(source), destination);
+  scheduler.add({.x = x, .y = y, .w = w, .h = h}, wavemode);
+  return true;
+}
+
+DisplayStats ScreenManager::flush() {
+  auto         batch = scheduler.take();
+  DisplayStats stats{};
+  if (batch.full_refresh) {
+    log(LogLevel::Debug, "Full refresh instead of {} partial updates", batch.updates.size());
+    stats += display_image(pending_frame, {.address    = image_buffer_address(back_buffer),
+                                           .wavemode   = WaveMode::GC16,
+                                           .area       = {.x = 0, .y = 0, .w = info.uiWidth, .h = info.uiHeight},
+                                           .wait_ready = 0},
+                           true);
+  } else {
+    // Everything in one batch goes to the same back buffer
+    for (const auto& update : batch.updates) {
+      const Rect rect(static_cast<int>(update.area.x), static_cast<int>(update.area.y),
+                      static_cast<int>(update.area.w), static_cast<int>(update.area.h));
+      stats += display_image(pending_frame(rect), {.address    = image_buffer_address(back_buffer),
+                                                   .wavemode   = update.wavemode,
+                                                   .area       = update.area,
+                                                   .wait_ready = 0});
+    }
+  }
+  finish_frame();
+  return stats;
+}
+
+DisplayStats ScreenManager::flush_if_due() {
+  if (!scheduler.due(it.predicted_ready())) return {};
+  return flush();
+}
+
+std::optional<ReadinessTracker::Clock::time_point> ScreenManager::next_flush_due() const {
+  return scheduler.due_at(it.predicted_ready());
+}
+
+void ScreenManager::set_refresh_policy(const RefreshPolicy& policy) { scheduler.policy = policy; }
+
+void ScreenManager::finish_frame() {
+  if (!back_buffer_used) return;
+  buffer_busy_until[back_buffer] = it.predicted_ready();
+  // Only regions that were just uploaded get displayed, so a stale back buffer never shows
+  back_buffer      = (back_buffer + 1) % image_buffer_count;
+  back_buffer_used = false;
 }
 
 void ScreenManager::clear_screen() {
-  cleared = true;
+  cleared     = true;
+  shadow_area = {};
   it.clear_area({.x = 0, .y = 0, .w = info.uiWidth, .h = info.uiHeight});
 }
+bool ScreenManager::wait_until_ready() { return it.wait_until_ready(); }
+ReadinessTracker::Clock::time_point ScreenManager::predicted_ready() const { return it.predicted_ready(); }
 void ScreenManager::set_vcom(double vcom) { /*it.set_vcom(vcom);*/ }
 void ScreenManager::set_rotation(int new_rotation) {
   this->rotation = new_rotation;  // should be from:
@@ -82,3 +391,79 @@ void ScreenManager::set_rotation(int new_rotation) {
   //     ROTATE_90_COUNTERCLOCKWISE = 2, //!<Rotate 270 degrees clockwise
   // };
 }
+// Cached frames were rendered with the old settings
+void ScreenManager::set_pixel_format(PixelFormat format) {
+  pixel_format = format;
+  frame_cache.clear();
+}
+void ScreenManager::set_tone_map(const std::optional<ToneMap>& map) {
+  tone_map = map;
+  frame_cache.clear();
+}
+void ScreenManager::set_dither_mode(DitherMode mode) {
+  dither_mode = mode;
+  if (!dither_pool && (mode == DitherMode::FloydSteinberg || mode == DitherMode::Atkinson)) {
+    dither_pool = std::make_unique<WorkerPool>(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+  }
+  frame_cache.clear();
+}
+void ScreenManager::set_frame_cache_size(size_t bytes) { frame_cache.set_max_bytes(bytes); }
+FrameCacheStats ScreenManager::frame_cache_stats() const { return frame_cache.stats(); }
+bool ScreenManager::set_resident_image_slots(uint32_t slots) {
+  if (slots > 0 && !image_buffer_layout_confirmed) {
+    log(LogLevel::Warning, "Not keeping images resident, the image buffer layout isn't confirmed");
+    resident_images.configure(0, 0, 0);
+    return false;
+  }
+  // Past every image buffer the controller has, so changing how many are used doesn't overlap them
+  const auto base = image_buffer_address(std::max(info.uiNumImgBuf, image_buffer_count));
+  resident_images.configure(base, info.uiWidth * info.uiHeight, slots);
+  log(LogLevel::Debug, "Keeping up to {} images resident from {:#x}", slots, base);
+  return true;
+}
+ResidentImageCacheStats ScreenManager::resident_image_stats() const { return resident_images.stats(); }
+void ScreenManager::invalidate_frame_cache(const std::filesystem::path& path) {
+  if (path.empty()) {
+    frame_cache.clear();
+  } else {
+    frame_cache.invalidate(path);
+  }
+}
+void ScreenManager::set_auto_waveform(bool enabled) { auto_waveform = enabled; }
+size_t ScreenManager::autotune_transfer_size(const std::filesystem::path& cache_file) {
+  // Tuning uploads test frames, the image buffer no longer matches the shadow afterwards
+  shadow_area = {};
+  return it.autotune_transfer_size(cache_file);
+}
+void ScreenManager::set_max_in_flight(size_t requests) { it.set_max_in_flight(requests); }
+bool ScreenManager::set_upload_engine(UploadEngine engine) { return it.set_upload_engine(engine); }
+std::shared_ptr<TransportMetrics> ScreenManager::get_transport_metrics() const { return it.get_transport_metrics(); }
+void ScreenManager::set_image_buffer_layout_confirmed(bool confirmed) {
+  image_buffer_layout_confirmed = confirmed;
+  if (confirmed) return;
+  // Nothing past buffer 0 may be written any more
+  set_image_buffer_count(1);
+  set_resident_image_slots(0);
+}
+bool ScreenManager::set_image_buffer_count(uint32_t count) {
+  const bool allowed = count <= 1 || image_buffer_layout_confirmed;
+  if (!allowed) {
+    log(LogLevel::Warning, "Using a single image buffer, the image buffer layout isn't confirmed");
+    count = 1;
+  }
+  image_buffer_count = std::clamp<uint32_t>(count, 1, std::max(info.uiNumImgBuf, 1u));
+  back_buffer        = 0;
+  back_buffer_used   = false;
+  buffer_busy_until.assign(image_buffer_count, it.predicted_ready());
+  log(LogLevel::Debug, "Using {} of {} image buffers", image_buffer_count, info.uiNumImgBuf);
+  return allowed;
+}
+bool ScreenManager::shadow_known(const Rect& area) const {
+  return area.x >= shadow_area.x && area.y >= shadow_area.y &&
+         area.x + area.width <= shadow_area.x + shadow_area.width &&
+         area.y + area.height <= shadow_area.y + shadow_area.height;
+}
+uint32_t ScreenManager::image_buffer_address(uint32_t index) const {
+  // Not read from the controller, see the header
+  return info.uiImageBufBase + index * info.uiWidth * info.uiHeight;
+}
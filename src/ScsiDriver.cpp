@@ -0,0 +1,46 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "ScsiDriver.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+// Parts of ScsiDriver every backend shares
+
+size_t ScsiDriver::make_strided_segments(Segments &segments, std::span<const uint8_t> header,
+                                         std::span<const uint8_t> rows, size_t rowBytes, size_t rowCount,
+                                         size_t stride) {
+    assert(rowCount == 0 || rows.size() >= stride * (rowCount - 1) + rowBytes);
+    segments[0] = header;
+    if (stride == rowBytes) {
+        segments[1] = rows.first(rowBytes * rowCount);
+        return 2;
+    }
+    // Only rows that aren't contiguous take a segment each
+    assert(rowCount < SPT_MAX_SEGMENTS);
+    for (size_t row = 0; row < rowCount; row++) {
+        segments[row + 1] = rows.subspan(row * stride, rowBytes);
+    }
+    return rowCount + 1;
+}
+
+bool ScsiDriver::collect_completion() const {
+    if (collected_count == collected.size()) {
+        log(LogLevel::Error, "{} completions were never collected, not queueing more", collected_count);
+        return false;
+    }
+    const auto completion = next_completion(10000);
+    if (!completion) { return false; }
+    collected[collected_count++] = *completion;
+    return true;
+}
+
+std::optional<ScsiCompletion> ScsiDriver::wait_for_completion(int timeoutMs) const {
+    if (collected_count == 0) { return next_completion(timeoutMs); }
+    const auto completion = collected[0];
+    std::move(collected.begin() + 1, collected.begin() + collected_count, collected.begin());
+    collected_count--;
+    return completion;
+}
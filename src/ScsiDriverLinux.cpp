@@ -5,33 +5,137 @@
 #include "ScsiDriver.hpp"
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <poll.h>
 #include <scsi/sg.h>
 #include <sys/ioctl.h>
 #include "unistd.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
 
-ScsiDriver::ScsiDriver(const char *path) {
+namespace {
+// A finished sg request as the metrics see it, latency measured on the host since sg only reports milliseconds
+TransportRecord make_record(const sg_io_hdr_t &io_hdr, std::chrono::steady_clock::time_point start) {
+    const auto resid = static_cast<size_t>(std::clamp<int>(io_hdr.resid, 0, static_cast<int>(io_hdr.dxfer_len)));
+    return {.requested = io_hdr.dxfer_len,
+            .transferred = io_hdr.dxfer_len - resid,
+            .ok = (io_hdr.info & SG_INFO_OK_MASK) == SG_INFO_OK,
+            .status = io_hdr.status,
+            .host_status = io_hdr.host_status,
+            .driver_status = io_hdr.driver_status,
+            .latency = std::chrono::steady_clock::now() - start};
+}
+
+// Request that never reached the device
+TransportRecord failed_record(size_t requested, std::chrono::steady_clock::time_point start) {
+    return {.requested = requested, .transferred = 0, .ok = false, .latency = std::chrono::steady_clock::now() - start};
+}
+
+size_t fill_iovecs(std::array<sg_iovec_t, SPT_MAX_SEGMENTS> &iovecs,
+                   std::span<const std::span<const uint8_t>> segments) {
+    size_t total = 0;
+    for (size_t i = 0; i < segments.size(); i++) {
+        iovecs[i].iov_base = const_cast<uint8_t *>(segments[i].data());
+        iovecs[i].iov_len = segments[i].size();
+        total += segments[i].size();
+    }
+    return total;
+}
+}
+
+ScsiDriver::ScsiDriver(const char *path) : path(path) {
     fd = open(path, O_RDWR | O_NONBLOCK);
     log(LogLevel::Debug, "constructed scsidriver for {}", path);
     if(fd < 0){
         throw std::runtime_error("Failed to open device");
     }
+    query_transfer_limits();
+}
+
+std::optional<ScsiDriver::InquiryData> ScsiDriver::inquiry(const char *path) {
+    // sg lets read only descriptors send INQUIRY
+    const int probe_fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (probe_fd < 0) {
+        log(LogLevel::Debug, "Couldn't open {} for inquiry {}", path, strerror(errno));
+        return std::nullopt;
+    }
+    InquiryData data{};
+    std::array<uint8_t, 6> cdb{0x12, 0x00, 0x00, 0x00, static_cast<uint8_t>(data.size()), 0x00};
+    sg_io_hdr_t io_hdr{};
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = cdb.size();
+    io_hdr.cmdp = cdb.data();
+    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len = data.size();
+    io_hdr.dxferp = data.data();
+    io_hdr.timeout = 1000;
+    const bool ok = ioctl(probe_fd, SG_IO, &io_hdr) >= 0 && (io_hdr.info & SG_INFO_OK_MASK) == SG_INFO_OK;
+    if (!ok) { log(LogLevel::Debug, "Inquiry of {} failed", path); }
+    close(probe_fd);
+    if (!ok) { return std::nullopt; }
+    return data;
 }
 
 ScsiDriver::ScsiDriver(ScsiDriver &&other) {
     log(LogLevel::Debug, "move constructed scsidriver for fd {}", other.fd);
     this->fd = other.fd;
+    this->next_request_id = other.next_request_id;
+    this->in_flight = std::exchange(other.in_flight, 0);
+    this->path = std::move(other.path);
+    this->max_transfer = other.max_transfer;
+    this->max_segments = other.max_segments;
+    this->metrics = other.metrics;
+    this->submitted = other.submitted;
+    this->collected = other.collected;
+    this->collected_count = std::exchange(other.collected_count, 0);
     other.fd = 0;
 }
 
 ScsiDriver &ScsiDriver::operator=(ScsiDriver &&other) {
     log(LogLevel::Debug, "move assigned scsidriver for fd {}", other.fd);
     this->fd = other.fd;
+    this->next_request_id = other.next_request_id;
+    this->in_flight = std::exchange(other.in_flight, 0);
+    this->path = std::move(other.path);
+    this->max_transfer = other.max_transfer;
+    this->max_segments = other.max_segments;
+    this->metrics = other.metrics;
+    this->submitted = other.submitted;
+    this->collected = other.collected;
+    this->collected_count = std::exchange(other.collected_count, 0);
     other.fd = 0;
     return *this;
 }
 
+void ScsiDriver::query_transfer_limits() {
+    // Grow the sg reserved buffer so large transfers don't need a fresh kernel allocation
+    int reserved = SPT_MAX_BUF_SIZE;
+    if (ioctl(fd, SG_SET_RESERVED_SIZE, &reserved) < 0 ||
+        ioctl(fd, SG_GET_RESERVED_SIZE, &reserved) < 0) {
+        log(LogLevel::Warning, "Couldn't query sg reserved size {}", strerror(errno));
+        return;
+    }
+    // Bytes the request queue takes in one command (max_sectors_kb)
+    int queue_max = SPT_MAX_BUF_SIZE;
+    if (ioctl(fd, BLKSECTGET, &queue_max) < 0) {
+        log(LogLevel::Debug, "Couldn't query queue limits {}", strerror(errno));
+        queue_max = SPT_BUF_SIZE;
+    }
+    int table_size = SPT_MAX_SEGMENTS;
+    if (ioctl(fd, SG_GET_SG_TABLESIZE, &table_size) < 0 || table_size <= 1) {
+        table_size = SPT_MAX_SEGMENTS;
+    }
+    max_transfer = std::max<size_t>(std::min({reserved, queue_max, SPT_MAX_BUF_SIZE}), 4096);
+    max_segments = std::min<size_t>(table_size, SPT_MAX_SEGMENTS);
+    log(LogLevel::Debug, "{}: reserved {} queue max {} segments {}, using up to {} per transfer",
+        path, reserved, queue_max, table_size, max_transfer);
+}
+
 ScsiDriver::~ScsiDriver() {
-    if (fd != 0) {
+    while (in_flight > 0 && next_completion(10000)) {}
+    if (fd > 0) {
         close(fd);
         log(LogLevel::Debug, "closed fd");
     } else {
@@ -43,20 +147,31 @@ std::optional<std::vector<uint8_t>> ScsiDriver::get_data(
         unsigned long dataTransferLength,
         std::span<const uint8_t, 16> commandDescriptorBlock) const {
     std::vector<uint8_t> buffer(dataTransferLength);
+    const auto received = get_data(buffer, commandDescriptorBlock);
+    if (!received) { return std::nullopt; }
+    buffer.resize(*received);
+    return buffer;
+}
+
+std::optional<size_t> ScsiDriver::get_data(std::span<uint8_t> buffer,
+                                           std::span<const uint8_t, 16> commandDescriptorBlock) const {
     sg_io_hdr_t io_hdr{};
     io_hdr.interface_id = 'S';
     io_hdr.cmd_len = commandDescriptorBlock.size();
     io_hdr.cmdp = const_cast<uint8_t *>(commandDescriptorBlock.data());
     io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
-    io_hdr.dxfer_len = dataTransferLength;
+    io_hdr.dxfer_len = buffer.size();
     io_hdr.dxferp = buffer.data();
     io_hdr.timeout = 1000;
+    const auto start = std::chrono::steady_clock::now();
     if (ioctl(fd, SG_IO, &io_hdr) < 0) {
+        metrics->record(commandDescriptorBlock, failed_record(buffer.size(), start));
         log(LogLevel::Error, "SG_IO memory read failed {}", strerror(errno));
         return std::nullopt;
     }
-    buffer.resize(dataTransferLength - io_hdr.resid);
-    return buffer;
+    const auto record = make_record(io_hdr, start);
+    metrics->record(commandDescriptorBlock, record);
+    return record.transferred;
 }
 
 bool ScsiDriver::write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
@@ -69,9 +184,140 @@ bool ScsiDriver::write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
     io_hdr.dxfer_len = data.size();
     io_hdr.dxferp = const_cast<uint8_t *>(data.data());
     io_hdr.timeout = 10000;
+    const auto start = std::chrono::steady_clock::now();
     if (ioctl(fd, SG_IO, &io_hdr) < 0) {
+        metrics->record(commandDescriptorBlock, failed_record(data.size(), start));
         log(LogLevel::Error, "SG_IO memory write failed {}", strerror(errno));
         return false;
     }
+    metrics->record(commandDescriptorBlock, make_record(io_hdr, start));
     return true;
 }
+
+bool ScsiDriver::write_data_vectored(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                     std::span<const std::span<const uint8_t>> segments) const {
+    assert(segments.size() <= max_segments);
+    std::array<sg_iovec_t, SPT_MAX_SEGMENTS> iovecs{};
+    const auto total = fill_iovecs(iovecs, segments);
+    sg_io_hdr_t io_hdr{};
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = commandDescriptorBlock.size();
+    io_hdr.cmdp = const_cast<uint8_t *>(commandDescriptorBlock.data());
+    io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+    io_hdr.iovec_count = segments.size();
+    io_hdr.dxfer_len = total;
+    io_hdr.dxferp = iovecs.data();
+    io_hdr.timeout = 10000;
+    const auto start = std::chrono::steady_clock::now();
+    if (ioctl(fd, SG_IO, &io_hdr) < 0) {
+        metrics->record(commandDescriptorBlock, failed_record(total, start));
+        log(LogLevel::Error, "SG_IO vectored memory write failed {}", strerror(errno));
+        return false;
+    }
+    metrics->record(commandDescriptorBlock, make_record(io_hdr, start));
+    return true;
+}
+
+bool ScsiDriver::write_data_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                    std::span<const uint8_t> header, std::span<const uint8_t> rows,
+                                    size_t rowBytes, size_t rowCount, size_t stride) const {
+    Segments segments{};
+    const auto count = make_strided_segments(segments, header, rows, rowBytes, rowCount, stride);
+    return write_data_vectored(commandDescriptorBlock, std::span(segments).first(count));
+}
+
+std::optional<uint32_t> ScsiDriver::submit_write(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                                 std::span<const std::span<const uint8_t>> segments) const {
+    assert(segments.size() <= max_segments);
+    // Also keeps the slots in submitted unique
+    if (in_flight >= SPT_MAX_IN_FLIGHT && !collect_completion()) { return std::nullopt; }
+    // The kernel copies the header, cdb and iovecs during write(), only the data has to outlive it
+    std::array<sg_iovec_t, SPT_MAX_SEGMENTS> iovecs{};
+    const auto total = fill_iovecs(iovecs, segments);
+    sg_io_hdr_t io_hdr{};
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = commandDescriptorBlock.size();
+    io_hdr.cmdp = const_cast<uint8_t *>(commandDescriptorBlock.data());
+    io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+    io_hdr.iovec_count = segments.size();
+    io_hdr.dxfer_len = total;
+    io_hdr.dxferp = iovecs.data();
+    io_hdr.timeout = 10000;
+    io_hdr.pack_id = static_cast<int>(next_request_id);
+    const auto start = std::chrono::steady_clock::now();
+    while (write(fd, &io_hdr, sizeof(io_hdr)) < 0) {
+        // EDOM means sg's queue for this fd is full, make room and retry
+        if ((errno == EDOM || errno == EAGAIN) && in_flight > 0) {
+            log(LogLevel::Debug, "sg queue full with {} requests, waiting", in_flight);
+            if (!collect_completion()) { return std::nullopt; }
+            continue;
+        }
+        metrics->record(commandDescriptorBlock, failed_record(total, start));
+        log(LogLevel::Error, "SG write submit failed {}", strerror(errno));
+        return std::nullopt;
+    }
+    submitted[next_request_id % SPT_MAX_IN_FLIGHT] = {.time = start,
+                                                      .bytes = total,
+                                                      .command = transport_command(commandDescriptorBlock)};
+    in_flight++;
+    return next_request_id++;
+}
+
+std::optional<uint32_t> ScsiDriver::submit_write_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                                         std::span<const uint8_t> header,
+                                                         std::span<const uint8_t> rows, size_t rowBytes,
+                                                         size_t rowCount, size_t stride) const {
+    Segments segments{};
+    const auto count = make_strided_segments(segments, header, rows, rowBytes, rowCount, stride);
+    return submit_write(commandDescriptorBlock, std::span(segments).first(count));
+}
+
+std::optional<ScsiCompletion> ScsiDriver::next_completion(int timeoutMs) const {
+    if (in_flight == 0) { return std::nullopt; }
+    pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+    const auto ready = poll(&pfd, 1, timeoutMs);
+    if (ready <= 0) {
+        log(LogLevel::Error, "Waiting for SG completion failed {}", ready == 0 ? "timeout" : strerror(errno));
+        return std::nullopt;
+    }
+    sg_io_hdr_t io_hdr{};
+    io_hdr.interface_id = 'S';
+    io_hdr.pack_id = -1;
+    if (read(fd, &io_hdr, sizeof(io_hdr)) < 0) {
+        log(LogLevel::Error, "SG read completion failed {}", strerror(errno));
+        return std::nullopt;
+    }
+    in_flight--;
+    const auto &request = submitted[static_cast<uint32_t>(io_hdr.pack_id) % SPT_MAX_IN_FLIGHT];
+    // Lengths are taken from what was submitted, the header read back only has to match by pack_id
+    io_hdr.dxfer_len = static_cast<unsigned int>(request.bytes);
+    metrics->record(request.command, make_record(io_hdr, request.time));
+    const ScsiCompletion completion{.id = static_cast<uint32_t>(io_hdr.pack_id),
+                                    .ok = (io_hdr.info & SG_INFO_OK_MASK) == SG_INFO_OK,
+                                    .status = io_hdr.status,
+                                    .host_status = io_hdr.host_status,
+                                    .driver_status = io_hdr.driver_status,
+                                    .resid = io_hdr.resid,
+                                    .duration_ms = io_hdr.duration};
+    if (!completion.ok) {
+        log(LogLevel::Error, "SG request {} failed: status {} host {} driver {}", completion.id,
+            completion.status, completion.host_status, completion.driver_status);
+    }
+    return completion;
+}
+
+void ScsiDriver::abandon_in_flight() const {
+    if (in_flight == 0 && collected_count == 0) { return; }
+    // sg drops what's queued on a descriptor when it's closed, so late completions can't reach the next transfer
+    log(LogLevel::Warning, "Abandoning {} requests, reopening {}", in_flight_count(), path);
+    close(fd);
+    fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        log(LogLevel::Error, "Couldn't reopen {} {}", path, strerror(errno));
+    } else {
+        int reserved = static_cast<int>(max_transfer);
+        ioctl(fd, SG_SET_RESERVED_SIZE, &reserved);
+    }
+    in_flight = 0;
+    collected_count = 0;
+}
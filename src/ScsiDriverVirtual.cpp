@@ -0,0 +1,189 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "ScsiDriver.hpp"
+#include "VirtualIT8951.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include <utility>
+
+// ScsiDriver for the IT8951_VIRTUAL_LIB build: commands go to an in-process VirtualIT8951
+// and every call takes as long as the device's timing model says.
+
+namespace {
+size_t total_size(std::span<const std::span<const uint8_t>> segments) {
+    size_t total = 0;
+    for (const auto &segment: segments) total += segment.size();
+    return total;
+}
+
+TransportRecord make_record(const VirtualIT8951::Result &result, size_t requested,
+                            std::chrono::steady_clock::time_point start) {
+    return {.requested = requested,
+            .transferred = result.transferred,
+            .ok = result.ok,
+            .status = static_cast<uint8_t>(result.ok ? 0 : 2),
+            .latency = std::chrono::steady_clock::now() - start};
+}
+}
+
+ScsiDriver::ScsiDriver(const char *path) : path(path), device(VirtualIT8951::attach(path)) {
+    max_transfer = device->get_config().max_transfer;
+    max_segments = SPT_MAX_SEGMENTS;
+    log(LogLevel::Debug, "constructed virtual scsidriver for {}", path);
+}
+
+std::optional<ScsiDriver::InquiryData> ScsiDriver::inquiry(const char *path) {
+    InquiryData data{};
+    std::array<uint8_t, 16> cdb{0x12, 0x00, 0x00, 0x00, static_cast<uint8_t>(data.size())};
+    if (!VirtualIT8951::attach(path)->read(cdb, data).ok) { return std::nullopt; }
+    return data;
+}
+
+ScsiDriver::ScsiDriver(ScsiDriver &&other) {
+    this->next_request_id = other.next_request_id;
+    this->in_flight = std::exchange(other.in_flight, 0);
+    this->path = std::move(other.path);
+    this->max_transfer = other.max_transfer;
+    this->max_segments = other.max_segments;
+    this->device = std::move(other.device);
+    this->pending = std::move(other.pending);
+    this->metrics = other.metrics;
+    this->submitted = other.submitted;
+    this->collected = other.collected;
+    this->collected_count = std::exchange(other.collected_count, 0);
+}
+
+ScsiDriver &ScsiDriver::operator=(ScsiDriver &&other) {
+    this->next_request_id = other.next_request_id;
+    this->in_flight = std::exchange(other.in_flight, 0);
+    this->path = std::move(other.path);
+    this->max_transfer = other.max_transfer;
+    this->max_segments = other.max_segments;
+    this->device = std::move(other.device);
+    this->pending = std::move(other.pending);
+    this->metrics = other.metrics;
+    this->submitted = other.submitted;
+    this->collected = other.collected;
+    this->collected_count = std::exchange(other.collected_count, 0);
+    return *this;
+}
+
+ScsiDriver::~ScsiDriver() {
+    while (in_flight > 0 && next_completion(10000)) {}
+}
+
+void ScsiDriver::query_transfer_limits() {}
+
+std::optional<std::vector<uint8_t>> ScsiDriver::get_data(
+        unsigned long dataTransferLength,
+        std::span<const uint8_t, 16> commandDescriptorBlock) const {
+    std::vector<uint8_t> buffer(dataTransferLength);
+    const auto received = get_data(buffer, commandDescriptorBlock);
+    if (!received) { return std::nullopt; }
+    buffer.resize(*received);
+    return buffer;
+}
+
+std::optional<size_t> ScsiDriver::get_data(std::span<uint8_t> buffer,
+                                           std::span<const uint8_t, 16> commandDescriptorBlock) const {
+    const auto start = std::chrono::steady_clock::now();
+    const auto result = device->read(commandDescriptorBlock, buffer);
+    std::this_thread::sleep_until(result.done);
+    metrics->record(commandDescriptorBlock, make_record(result, buffer.size(), start));
+    if (!result.ok) {
+        log(LogLevel::Error, "Virtual memory read failed");
+        return std::nullopt;
+    }
+    return result.transferred;
+}
+
+bool ScsiDriver::write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
+                            std::span<const uint8_t> data) const {
+    const std::array<std::span<const uint8_t>, 1> segments{data};
+    return write_data_vectored(commandDescriptorBlock, segments);
+}
+
+bool ScsiDriver::write_data_vectored(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                     std::span<const std::span<const uint8_t>> segments) const {
+    assert(segments.size() <= max_segments);
+    const auto start = std::chrono::steady_clock::now();
+    const auto result = device->write(commandDescriptorBlock, segments);
+    std::this_thread::sleep_until(result.done);
+    metrics->record(commandDescriptorBlock, make_record(result, total_size(segments), start));
+    if (!result.ok) {
+        log(LogLevel::Error, "Virtual memory write failed");
+    }
+    return result.ok;
+}
+
+bool ScsiDriver::write_data_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                    std::span<const uint8_t> header, std::span<const uint8_t> rows,
+                                    size_t rowBytes, size_t rowCount, size_t stride) const {
+    Segments segments{};
+    const auto count = make_strided_segments(segments, header, rows, rowBytes, rowCount, stride);
+    return write_data_vectored(commandDescriptorBlock, std::span(segments).first(count));
+}
+
+std::optional<uint32_t> ScsiDriver::submit_write(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                                 std::span<const std::span<const uint8_t>> segments) const {
+    // Like sg, only SPT_MAX_IN_FLIGHT requests are queued at once
+    if (in_flight >= SPT_MAX_IN_FLIGHT && !collect_completion()) { return std::nullopt; }
+    const auto submitted_at = std::chrono::steady_clock::now();
+    const auto result = device->write(commandDescriptorBlock, segments);
+    const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(result.done - submitted_at);
+    submitted[next_request_id % SPT_MAX_IN_FLIGHT] = {.time = submitted_at,
+                                                      .bytes = total_size(segments),
+                                                      .command = transport_command(commandDescriptorBlock)};
+    pending.emplace_back(result.done, ScsiCompletion{.id = next_request_id,
+                                                     .ok = result.ok,
+                                                     .status = static_cast<uint8_t>(result.ok ? 0 : 2),
+                                                     .host_status = 0,
+                                                     .driver_status = 0,
+                                                     .resid = static_cast<int>(total_size(segments) - result.transferred),
+                                                     .duration_ms = static_cast<uint32_t>(duration.count())});
+    in_flight++;
+    return next_request_id++;
+}
+
+std::optional<uint32_t> ScsiDriver::submit_write_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                                         std::span<const uint8_t> header,
+                                                         std::span<const uint8_t> rows, size_t rowBytes,
+                                                         size_t rowCount, size_t stride) const {
+    Segments segments{};
+    const auto count = make_strided_segments(segments, header, rows, rowBytes, rowCount, stride);
+    return submit_write(commandDescriptorBlock, std::span(segments).first(count));
+}
+
+std::optional<ScsiCompletion> ScsiDriver::next_completion(int timeoutMs) const {
+    if (in_flight == 0 || pending.empty()) { return std::nullopt; }
+    // The link is modelled serially, so requests finish in submission order
+    const auto [done, completion] = pending.front();
+    if (done > std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs)) {
+        log(LogLevel::Error, "Waiting for virtual completion failed timeout");
+        return std::nullopt;
+    }
+    std::this_thread::sleep_until(done);
+    pending.pop_front();
+    in_flight--;
+    const auto &request = submitted[completion.id % SPT_MAX_IN_FLIGHT];
+    metrics->record(request.command, {.requested = request.bytes,
+                                      .transferred = request.bytes - static_cast<size_t>(completion.resid),
+                                      .ok = completion.ok,
+                                      .status = completion.status,
+                                      .latency = std::chrono::steady_clock::now() - request.time});
+    if (!completion.ok) {
+        log(LogLevel::Error, "Virtual request {} failed", completion.id);
+    }
+    return completion;
+}
+
+void ScsiDriver::abandon_in_flight() const {
+    // The modelled device already took the data when the requests were submitted
+    pending.clear();
+    in_flight = 0;
+    collected_count = 0;
+}
@@ -3,8 +3,23 @@
  * SPDX-License-Identifier: Apache-2.0
 */
 #include "ScsiDriver.hpp"
+#include <algorithm>
+#include <utility>
 
-ScsiDriver::ScsiDriver(const char* path) {
+namespace {
+TransportRecord make_record(const SCSI_PASS_THROUGH_DIRECT& request, bool ok, size_t requested,
+                            std::chrono::steady_clock::time_point start) {
+  // DataTransferLength is updated to what was actually moved
+  return {.requested   = requested,
+          .transferred = ok ? request.DataTransferLength : 0,
+          .ok          = ok,
+          .status      = request.ScsiStatus,
+          .latency     = std::chrono::steady_clock::now() - start};
+}
+}  // namespace
+
+// SCSI_PASS_THROUGH_DIRECT is limited to 64KB, so the SPT_BUF_SIZE default is kept
+ScsiDriver::ScsiDriver(const char* path) : path(path) {
   hDev = CreateFile(path,                                  // file name
                     (GENERIC_READ | GENERIC_WRITE),        // access mode
                     (FILE_SHARE_READ | FILE_SHARE_WRITE),  // share mode
@@ -14,13 +29,29 @@ ScsiDriver::ScsiDriver(const char* path) {
                     nullptr                                // handle to template file
   );
 }
+// Opening is only a CreateFile here, nothing is set up that the inquiry could avoid
+std::optional<ScsiDriver::InquiryData> ScsiDriver::inquiry(const char* path) {
+  const ScsiDriver              driver(path);
+  InquiryData                   data{};
+  const std::array<uint8_t, 16> cdb{0x12, 0x00, 0x00, 0x00, static_cast<uint8_t>(data.size())};
+  if (driver.get_handle() == INVALID_HANDLE_VALUE || !driver.get_data(data, cdb)) return std::nullopt;
+  return data;
+}
 ScsiDriver::ScsiDriver(ScsiDriver&& other) {
-  this->hDev = other.hDev;
-  other.hDev = 0;
+  this->hDev      = other.hDev;
+  this->path      = std::move(other.path);
+  this->completed = std::move(other.completed);
+  this->in_flight = std::exchange(other.in_flight, 0);
+  this->metrics   = other.metrics;
+  other.hDev      = 0;
 }
 ScsiDriver& ScsiDriver::operator=(ScsiDriver&& other) {
-  this->hDev = other.hDev;
-  other.hDev = 0;
+  this->hDev      = other.hDev;
+  this->path      = std::move(other.path);
+  this->completed = std::move(other.completed);
+  this->in_flight = std::exchange(other.in_flight, 0);
+  this->metrics   = other.metrics;
+  other.hDev      = 0;
   return *this;
 }
 ScsiDriver::~ScsiDriver() {
@@ -29,7 +60,15 @@ ScsiDriver::~ScsiDriver() {
 std::optional<std::vector<uint8_t>> ScsiDriver::get_data(
     unsigned long                dataTransferLength,
     std::span<const uint8_t, 16> commandDescriptorBlock) const {
-  std::vector<uint8_t>     buffer(dataTransferLength);
+  std::vector<uint8_t> buffer(dataTransferLength);
+  const auto           received = get_data(buffer, commandDescriptorBlock);
+  if (!received) return std::nullopt;
+  buffer.resize(*received);
+  return buffer;
+}
+
+std::optional<size_t> ScsiDriver::get_data(std::span<uint8_t>           buffer,
+                                           std::span<const uint8_t, 16> commandDescriptorBlock) const {
   unsigned long            dwReturnBytes = 0;
   SCSI_PASS_THROUGH_DIRECT scsiPassThroughDirect{
       .Length             = sizeof(SCSI_PASS_THROUGH_DIRECT),
@@ -40,27 +79,30 @@ std::optional<std::vector<uint8_t>> ScsiDriver::get_data(
       .CdbLength          = 16,
       .SenseInfoLength    = 0,
       .DataIn             = SCSI_IOCTL_DATA_IN,
-      .DataTransferLength = dataTransferLength,
+      .DataTransferLength = static_cast<unsigned long>(buffer.size()),
       .TimeOutValue       = 5,
       .DataBuffer         = (void*)buffer.data(),
       .SenseInfoOffset    = 0,
   };
 
   std::memcpy(scsiPassThroughDirect.Cdb, commandDescriptorBlock.data(), 16);
-  if (!DeviceIoControl(hDev, IOCTL_SCSI_PASS_THROUGH_DIRECT, &scsiPassThroughDirect,
-                       sizeof(SCSI_PASS_THROUGH_DIRECT),  // sizeof( TSPTWBData),
-                       &scsiPassThroughDirect,
-                       sizeof(SCSI_PASS_THROUGH_DIRECT),  // sizeof( TSPTWBData),
-                       &dwReturnBytes, nullptr)) {
+  const auto start = std::chrono::steady_clock::now();
+  const bool ok    = DeviceIoControl(hDev, IOCTL_SCSI_PASS_THROUGH_DIRECT, &scsiPassThroughDirect,
+                                     sizeof(SCSI_PASS_THROUGH_DIRECT),  // sizeof( TSPTWBData),
+                                     &scsiPassThroughDirect,
+                                     sizeof(SCSI_PASS_THROUGH_DIRECT),  // sizeof( TSPTWBData),
+                                     &dwReturnBytes, nullptr);
+  metrics->record(commandDescriptorBlock, make_record(scsiPassThroughDirect, ok, buffer.size(), start));
+  if (!ok) {
     log(LogLevel::Error, "Couldn't retrieve data from SCSI device, Error: {}",
         format_last_error(GetLastError()));
     return std::nullopt;
   }
 
-  buffer.resize(dwReturnBytes);
-  log(LogLevel::Debug, "Data from scsi call {}",
-      fmt::format("{:x}", fmt::join(buffer, ",")));
-  return buffer;
+  // DataTransferLength now holds what was read, dwReturnBytes only the size of the request struct
+  const auto received = std::min<size_t>(scsiPassThroughDirect.DataTransferLength, buffer.size());
+  log(LogLevel::Debug, "Data from scsi call {:x}", fmt::join(buffer.first(received), ","));
+  return received;
 }
 
 bool ScsiDriver::write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
@@ -81,7 +123,8 @@ bool ScsiDriver::write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
       .SenseInfoOffset    = 0,
   };
   std::memcpy(scsiPassThroughDirect.Cdb, commandDescriptorBlock.data(), 16);
-  return DeviceIoControl(
+  const auto start = std::chrono::steady_clock::now();
+  const bool ok    = DeviceIoControl(
       hDev,
       IOCTL_SCSI_PASS_THROUGH_DIRECT,  // IOCTL_SCSI_PASS_THROUGH_DIRECT,//IOCTL_SCSI_PASS_THROUGH,
       &scsiPassThroughDirect,
@@ -89,4 +132,68 @@ bool ScsiDriver::write_data(std::span<const uint8_t, 16> commandDescriptorBlock,
       &scsiPassThroughDirect,
       sizeof(SCSI_PASS_THROUGH_DIRECT),  //+sizeof(gSPTDataBuf),
       &dwReturnBytes, nullptr);
+  metrics->record(commandDescriptorBlock, make_record(scsiPassThroughDirect, ok, data.size(), start));
+  return ok;
+}
+
+// SCSI_PASS_THROUGH_DIRECT only takes a single buffer, so segments are joined here
+bool ScsiDriver::write_data_vectored(std::span<const uint8_t, 16>              commandDescriptorBlock,
+                                     std::span<const std::span<const uint8_t>> segments) const {
+  std::vector<uint8_t> buffer;
+  for (const auto& segment : segments) buffer.insert(buffer.end(), segment.begin(), segment.end());
+  return write_data(commandDescriptorBlock, buffer);
+}
+
+bool ScsiDriver::write_data_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                    std::span<const uint8_t>     header,
+                                    std::span<const uint8_t>     rows,
+                                    size_t                       rowBytes,
+                                    size_t                       rowCount,
+                                    size_t                       stride) const {
+  std::vector<uint8_t> buffer(header.begin(), header.end());
+  for (size_t row = 0; row < rowCount; row++) {
+    const auto line = rows.subspan(row * stride, rowBytes);
+    buffer.insert(buffer.end(), line.begin(), line.end());
+  }
+  return write_data(commandDescriptorBlock, buffer);
+}
+
+// There is no queued pass through here, requests complete while being submitted and are recorded then
+std::optional<uint32_t> ScsiDriver::submit_write(std::span<const uint8_t, 16>              commandDescriptorBlock,
+                                                 std::span<const std::span<const uint8_t>> segments) const {
+  const bool ok = write_data_vectored(commandDescriptorBlock, segments);
+  completed.push_back({.id            = next_request_id,
+                       .ok            = ok,
+                       .status        = 0,
+                       .host_status   = 0,
+                       .driver_status = 0,
+                       .resid         = 0,
+                       .duration_ms   = 0});
+  in_flight++;
+  return next_request_id++;
+}
+
+std::optional<uint32_t> ScsiDriver::submit_write_strided(std::span<const uint8_t, 16> commandDescriptorBlock,
+                                                         std::span<const uint8_t>     header,
+                                                         std::span<const uint8_t>     rows,
+                                                         size_t                       rowBytes,
+                                                         size_t                       rowCount,
+                                                         size_t                       stride) const {
+  std::vector<std::span<const uint8_t>> segments{header};
+  for (size_t row = 0; row < rowCount; row++) segments.push_back(rows.subspan(row * stride, rowBytes));
+  return submit_write(commandDescriptorBlock, segments);
+}
+
+std::optional<ScsiCompletion> ScsiDriver::next_completion(int) const {
+  if (completed.empty()) return std::nullopt;
+  const auto completion = completed.front();
+  completed.erase(completed.begin());
+  in_flight--;
+  return completion;
+}
+
+void ScsiDriver::abandon_in_flight() const {
+  completed.clear();
+  in_flight       = 0;
+  collected_count = 0;
 }
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "TransportMetrics.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace {
+size_t latency_bucket(std::chrono::nanoseconds latency) {
+  const auto us = static_cast<uint64_t>(std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0));
+  // Below 16us is bucket 0, every doubling after that one more
+  return std::min<size_t>(std::bit_width(us >> 4), latency_bucket_count - 1);
+}
+}  // namespace
+
+TransportCommand transport_command(std::span<const uint8_t, 16> cdb) {
+  // IT8951 vendor commands are 0xFE with the actual command in byte 6
+  if (cdb[0] != 0xFE) return TransportCommand::Other;
+  switch (cdb[6]) {
+    case 0x83: return TransportCommand::ReadRegister;
+    case 0x84: return TransportCommand::WriteRegister;
+    case 0xA2: return TransportCommand::LoadImage;
+    case 0x94: return TransportCommand::Display;
+    case 0xA3: return TransportCommand::Pmic;
+    case 0x81: return TransportCommand::ReadMemory;
+    case 0x82: return TransportCommand::WriteMemory;
+    case 0xA5: return TransportCommand::FastWriteMemory;
+    default: return TransportCommand::Other;
+  }
+}
+
+std::chrono::microseconds CommandMetrics::latency_percentile(double fraction) const {
+  if (commands == 0) return std::chrono::microseconds(0);
+  const auto target = std::max<uint64_t>(
+      static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * static_cast<double>(commands))), 1);
+  const auto max  = std::chrono::ceil<std::chrono::microseconds>(max_latency);
+  uint64_t   seen = 0;
+  for (size_t bucket = 0; bucket + 1 < latency_bucket_count; bucket++) {
+    seen += latency_histogram[bucket];
+    if (seen >= target) return std::min(latency_bucket_bound(bucket), max);
+  }
+  return max;
+}
+
+void TransportMetrics::record(TransportCommand command, const TransportRecord& record) {
+  auto&      counter = counters[static_cast<size_t>(command)];
+  const auto ns      = static_cast<int64_t>(record.latency.count());
+  counter.commands.fetch_add(1, std::memory_order_relaxed);
+  if (!record.ok) counter.failed.fetch_add(1, std::memory_order_relaxed);
+  if (record.status != 0) counter.status_errors.fetch_add(1, std::memory_order_relaxed);
+  if (record.host_status != 0) counter.host_errors.fetch_add(1, std::memory_order_relaxed);
+  if (record.driver_status != 0) counter.driver_errors.fetch_add(1, std::memory_order_relaxed);
+  if (record.ok && record.transferred < record.requested) {
+    counter.short_transfers.fetch_add(1, std::memory_order_relaxed);
+  }
+  counter.bytes.fetch_add(record.transferred, std::memory_order_relaxed);
+  counter.total_latency_ns.fetch_add(ns, std::memory_order_relaxed);
+  auto max = counter.max_latency_ns.load(std::memory_order_relaxed);
+  while (ns > max && !counter.max_latency_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+  counter.latency_histogram[latency_bucket(record.latency)].fetch_add(1, std::memory_order_relaxed);
+}
+
+TransportMetricsSnapshot TransportMetrics::snapshot() const {
+  TransportMetricsSnapshot snapshot;
+  for (size_t i = 0; i < transport_command_count; i++) {
+    const auto& counter = counters[i];
+    auto&       metrics = snapshot.commands[i];
+    metrics.commands        = counter.commands.load(std::memory_order_relaxed);
+    metrics.failed          = counter.failed.load(std::memory_order_relaxed);
+    metrics.status_errors   = counter.status_errors.load(std::memory_order_relaxed);
+    metrics.host_errors     = counter.host_errors.load(std::memory_order_relaxed);
+    metrics.driver_errors   = counter.driver_errors.load(std::memory_order_relaxed);
+    metrics.short_transfers = counter.short_transfers.load(std::memory_order_relaxed);
+    metrics.bytes           = counter.bytes.load(std::memory_order_relaxed);
+    metrics.total_latency   = std::chrono::nanoseconds(counter.total_latency_ns.load(std::memory_order_relaxed));
+    metrics.max_latency     = std::chrono::nanoseconds(counter.max_latency_ns.load(std::memory_order_relaxed));
+    for (size_t bucket = 0; bucket < latency_bucket_count; bucket++) {
+      metrics.latency_histogram[bucket] = counter.latency_histogram[bucket].load(std::memory_order_relaxed);
+    }
+  }
+  return snapshot;
+}
+
+void TransportMetrics::reset() {
+  for (auto& counter : counters) {
+    counter.commands.store(0, std::memory_order_relaxed);
+    counter.failed.store(0, std::memory_order_relaxed);
+    counter.status_errors.store(0, std::memory_order_relaxed);
+    counter.host_errors.store(0, std::memory_order_relaxed);
+    counter.driver_errors.store(0, std::memory_order_relaxed);
+    counter.short_transfers.store(0, std::memory_order_relaxed);
+    counter.bytes.store(0, std::memory_order_relaxed);
+    counter.total_latency_ns.store(0, std::memory_order_relaxed);
+    counter.max_latency_ns.store(0, std::memory_order_relaxed);
+    for (auto& bucket : counter.latency_histogram) bucket.store(0, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "VirtualIT8951.hpp"
+#include <algorithm>
+#include <cstring>
+#include "IT8951.hpp"
+#include "log.hpp"
+
+namespace {
+constexpr uint32_t LUTAFSR = 0x18001224;
+constexpr uint32_t UP1SR   = 0x18001138;
+constexpr uint32_t BGVR    = 0x18001250;
+constexpr uint32_t register_base = 0x18000000;
+// Same per pixel preparation cost the readiness tracker assumes
+constexpr double pixel_time_ns = 10;
+
+std::mutex                                                      registry_mutex;
+std::unordered_map<std::string, std::shared_ptr<VirtualIT8951>> registry;
+
+uint32_t read_be32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) << 24 | static_cast<uint32_t>(data[1]) << 16 |
+         static_cast<uint32_t>(data[2]) << 8 | data[3];
+}
+
+void write_be32(uint8_t* data, uint32_t value) {
+  data[0] = static_cast<uint8_t>(value >> 24);
+  data[1] = static_cast<uint8_t>(value >> 16);
+  data[2] = static_cast<uint8_t>(value >> 8);
+  data[3] = static_cast<uint8_t>(value);
+}
+
+// Register address of an IT8951 vendor command
+uint32_t cdb_address(std::span<const uint8_t, 16> cdb) { return read_be32(cdb.data() + 2); }
+// Byte count of the memory commands
+size_t cdb_length(std::span<const uint8_t, 16> cdb) { return static_cast<size_t>(cdb[7]) << 8 | cdb[8]; }
+}  // namespace
+
+VirtualIT8951::VirtualIT8951(const VirtualDeviceConfig& config)
+    : config(config),
+      memory(std::max(config.sdram_bytes,
+                      static_cast<size_t>(config.image_buffer_count) * config.width * config.height),
+             0xFF),
+      panel(static_cast<size_t>(config.width) * config.height, 0xFF) {}
+
+std::shared_ptr<VirtualIT8951> VirtualIT8951::attach(const std::string& path) {
+  std::lock_guard lock(registry_mutex);
+  auto&           device = registry[path];
+  if (!device) {
+    log(LogLevel::Debug, "Creating virtual IT8951 for {}", path);
+    device = std::make_shared<VirtualIT8951>();
+  }
+  return device;
+}
+
+void VirtualIT8951::register_device(const std::string& path, std::shared_ptr<VirtualIT8951> device) {
+  std::lock_guard lock(registry_mutex);
+  registry[path] = std::move(device);
+}
+
+void VirtualIT8951::unregister_device(const std::string& path) {
+  std::lock_guard lock(registry_mutex);
+  registry.erase(path);
+}
+
+VirtualIT8951::Result VirtualIT8951::read(std::span<const uint8_t, 16> cdb, std::span<uint8_t> data) {
+  std::lock_guard lock(mutex);
+  counters.commands++;
+  bool ok = true;
+  std::fill(data.begin(), data.end(), 0);
+  if (cdb[0] == 0x12) {
+    // Inquiry, the vendor and product strings start at byte 8
+    constexpr std::string_view product = "Generic Storage RamDisc 1.00";
+    if (data.size() > 8) std::memcpy(data.data() + 8, product.data(), std::min(product.size(), data.size() - 8));
+  } else if (cdb[0] == 0xFE && cdb[6] == 0x80) {
+    IT8951SystemInfo info{};
+    info.uiStandardCmdNo = 0x10;
+    info.uiSignature     = 0x31353938;
+    info.uiWidth         = config.width;
+    info.uiHeight        = config.height;
+    info.uiImageBufBase  = config.image_buffer_base;
+    info.uiUpdateBufBase = config.image_buffer_base + config.image_buffer_count * config.width * config.height;
+    info.uiModeNo        = static_cast<unsigned int>(config.frame_counts.size());
+    std::copy(config.frame_counts.begin(), config.frame_counts.end(), info.uiFrameCount);
+    info.uiNumImgBuf = config.image_buffer_count;
+    const auto words = reinterpret_cast<uint32_t*>(&info);
+    for (size_t i = 0; i < sizeof(info) / sizeof(uint32_t); i++) write_be32(reinterpret_cast<uint8_t*>(words + i), words[i]);
+    std::memcpy(data.data(), &info, std::min(sizeof(info), data.size()));
+  } else if (cdb[0] == 0xFE && cdb[6] == 0x83 && data.size() >= 4) {
+    write_be32(data.data(), register_value(cdb_address(cdb)));
+  } else if (cdb[0] == 0xFE && cdb[6] == 0x81 && data.size() >= cdb_length(cdb)) {
+    ok = read_memory(cdb_address(cdb), data.first(cdb_length(cdb)));
+  } else {
+    log(LogLevel::Warning, "Virtual IT8951 doesn't know read command {:#04x} {:#04x}", cdb[0], cdb[6]);
+    ok = false;
+  }
+  if (!ok) counters.failed++;
+  counters.bytes_read += data.size();
+  return {.ok = ok, .transferred = ok ? data.size() : 0, .done = transfer(data.size())};
+}
+
+VirtualIT8951::Result VirtualIT8951::write(std::span<const uint8_t, 16> cdb,
+                                           std::span<const std::span<const uint8_t>> segments) {
+  std::lock_guard lock(mutex);
+  joined.clear();
+  for (const auto& segment : segments) joined.insert(joined.end(), segment.begin(), segment.end());
+  counters.commands++;
+  bool ok = false;
+  if (cdb[0] == 0xFE) {
+    switch (cdb[6]) {
+      case 0x84:
+        ok = joined.size() >= 4;
+        if (ok) registers[cdb_address(cdb)] = read_be32(joined.data());
+        break;
+      case 0x82:
+      case 0xA5:
+        ok = joined.size() == cdb_length(cdb) && write_memory(cdb_address(cdb), joined);
+        break;
+      case 0xA2: ok = load_image_area(joined); break;
+      case 0x94: ok = display_area(joined); break;
+      case 0xA3:
+        // VCOM in bytes 7-8, set flag in 9, power in 10-11
+        vcom_mv = static_cast<uint16_t>(cdb[7] << 8 | cdb[8]);
+        ok      = true;
+        break;
+      default: break;
+    }
+  }
+  if (!ok) {
+    log(LogLevel::Warning, "Virtual IT8951 rejected write command {:#04x} {:#04x}", cdb[0], cdb[6]);
+    counters.failed++;
+  }
+  counters.bytes_written += joined.size();
+  return {.ok = ok, .transferred = ok ? joined.size() : 0, .done = transfer(joined.size())};
+}
+
+VirtualDeviceStats VirtualIT8951::stats() const {
+  std::lock_guard lock(mutex);
+  return counters;
+}
+
+void VirtualIT8951::reset_stats() {
+  std::lock_guard lock(mutex);
+  counters = {};
+}
+
+std::vector<uint8_t> VirtualIT8951::panel_image() const {
+  std::lock_guard lock(mutex);
+  return panel;
+}
+
+bool VirtualIT8951::busy() const {
+  std::lock_guard lock(mutex);
+  return Clock::now() < lut_busy_until;
+}
+
+uint16_t VirtualIT8951::vcom() const {
+  std::lock_guard lock(mutex);
+  return vcom_mv;
+}
+
+VirtualIT8951::Clock::time_point VirtualIT8951::transfer(size_t bytes) {
+  const auto modelled = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      config.command_latency + std::chrono::duration<double>(static_cast<double>(bytes) / config.usb_bytes_per_second));
+  counters.link_busy += modelled;
+  link_free = std::max(link_free, Clock::now()) +
+              std::chrono::duration_cast<Clock::duration>(modelled * config.time_scale);
+  return link_free;
+}
+
+uint8_t* VirtualIT8951::memory_at(uint32_t address, size_t size) {
+  if (address < config.image_buffer_base || address - config.image_buffer_base + size > memory.size()) return nullptr;
+  return memory.data() + (address - config.image_buffer_base);
+}
+
+uint32_t VirtualIT8951::register_value(uint32_t address) {
+  return address == LUTAFSR ? static_cast<uint32_t>(Clock::now() < lut_busy_until) : registers[address];
+}
+
+bool VirtualIT8951::read_memory(uint32_t address, std::span<uint8_t> data) {
+  if (address >= register_base) {
+    for (size_t i = 0; i < data.size(); i++) {
+      const auto byte_address = static_cast<uint32_t>(address + i);
+      data[i] = static_cast<uint8_t>(register_value(byte_address & ~3u) >> (8 * (byte_address & 3)));
+    }
+    return true;
+  }
+  const auto* source = memory_at(address, data.size());
+  if (!source) return false;
+  std::memcpy(data.data(), source, data.size());
+  return true;
+}
+
+bool VirtualIT8951::write_memory(uint32_t address, std::span<const uint8_t> data) {
+  if (address >= register_base) {
+    // Only whole registers, a partial word write isn't something the library does
+    if (address % 4 != 0 || data.size() % 4 != 0) return false;
+    for (size_t i = 0; i < data.size(); i += 4) {
+      registers[static_cast<uint32_t>(address + i)] = static_cast<uint32_t>(data[i + 3]) << 24 |
+                                                      static_cast<uint32_t>(data[i + 2]) << 16 |
+                                                      static_cast<uint32_t>(data[i + 1]) << 8 | data[i];
+    }
+    return true;
+  }
+  auto* destination = memory_at(address, data.size());
+  if (!destination) return false;
+  std::memcpy(destination, data.data(), data.size());
+  return true;
+}
+
+bool VirtualIT8951::load_image_area(std::span<const uint8_t> data) {
+  if (data.size() < sizeof(IT8951ImgLoadArea)) return false;
+  const auto address = read_be32(data.data());
+  const auto x = read_be32(data.data() + 4), y = read_be32(data.data() + 8);
+  const auto w = read_be32(data.data() + 12), h = read_be32(data.data() + 16);
+  const auto pixels = data.subspan(sizeof(IT8951ImgLoadArea));
+  if (pixels.size() < static_cast<size_t>(w) * h) return false;
+  // Rows are panel width apart in the image buffer
+  for (uint32_t row = 0; row < h; row++) {
+    auto* destination = memory_at(address + (y + row) * config.width + x, w);
+    if (!destination) return false;
+    std::memcpy(destination, pixels.data() + static_cast<size_t>(row) * w, w);
+  }
+  counters.loads++;
+  return true;
+}
+
+bool VirtualIT8951::display_area(std::span<const uint8_t> data) {
+  if (data.size() < sizeof(IT8951DisplayArea)) return false;
+  const auto address = read_be32(data.data());
+  const auto mode    = read_be32(data.data() + 4);
+  const auto x = read_be32(data.data() + 8), y = read_be32(data.data() + 12);
+  const auto w = read_be32(data.data() + 16), h = read_be32(data.data() + 20);
+  if (x + w > config.width || y + h > config.height) return false;
+
+  if (address == 0 && mode == static_cast<uint32_t>(WaveMode::Init)) {
+    // Clearing drives the area to white without reading an image buffer
+    for (uint32_t row = 0; row < h; row++) std::fill_n(panel.data() + (y + row) * config.width + x, w, 0xFF);
+  } else if (registers[UP1SR] & (1 << 18)) {
+    // 1bpp mode, a byte holds 8 pixels with the first one in the lowest bit
+    const auto set     = static_cast<uint8_t>(registers[BGVR]);
+    const auto cleared = static_cast<uint8_t>(registers[BGVR] >> 8);
+    for (uint32_t row = 0; row < h; row++) {
+      const auto* source = memory_at(address + (y + row) * config.width, (x + w + 7) / 8);
+      if (!source) return false;
+      for (uint32_t px = x; px < x + w; px++) {
+        panel[(y + row) * config.width + px] = source[px / 8] >> (px % 8) & 1 ? set : cleared;
+      }
+    }
+  } else {
+    for (uint32_t row = 0; row < h; row++) {
+      const auto* source = memory_at(address + (y + row) * config.width + x, w);
+      if (!source) return false;
+      std::memcpy(panel.data() + (y + row) * config.width + x, source, w);
+    }
+  }
+
+  const auto frames   = config.frame_counts[mode % config.frame_counts.size()];
+  const auto modelled = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double, std::milli>(
+      frames * config.frame_time_ms + static_cast<double>(w) * h * pixel_time_ns / 1e6));
+  counters.refresh_busy += modelled;
+  lut_busy_until = std::max(lut_busy_until, Clock::now()) +
+                   std::chrono::duration_cast<Clock::duration>(modelled * config.time_scale);
+  counters.displays++;
+  return true;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "WaveformSelection.hpp"
+#include <cassert>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+// Share of black and white pixels above which gray content is treated like text
+constexpr double text_like_ratio = 0.9;
+
+void histogram_row(const uint8_t* row, uint32_t width, GrayHistogram& histogram) {
+  uint32_t x = 0;
+#if defined(__SSE2__)
+  // One 8 bit counter per bin and byte lane, compare results are -1 so subtracting counts up.
+  // The counters are folded into the histogram before they can overflow.
+  const auto nibble_mask = _mm_set1_epi8(0x0F);
+  while (x + 16 <= width) {
+    __m128i counters[16];
+    for (auto& counter : counters) counter = _mm_setzero_si128();
+    for (int block = 0; block < 255 && x + 16 <= width; block++, x += 16) {
+      const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+      const auto levels = _mm_and_si128(_mm_srli_epi16(pixels, 4), nibble_mask);
+      for (int bin = 0; bin < 16; bin++) {
+        counters[bin] = _mm_sub_epi8(counters[bin], _mm_cmpeq_epi8(levels, _mm_set1_epi8(static_cast<char>(bin))));
+      }
+    }
+    for (int bin = 0; bin < 16; bin++) {
+      const auto sums = _mm_sad_epu8(counters[bin], _mm_setzero_si128());
+      histogram[bin] += static_cast<uint64_t>(_mm_cvtsi128_si32(sums)) +
+                        static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+  }
+#endif
+  for (; x < width; x++) histogram[row[x] >> 4]++;
+}
+}  // namespace
+
+GrayHistogram gray_histogram(const cv::Mat& img) {
+  assert(img.elemSize() == 1);
+  GrayHistogram histogram{};
+  for (int y = 0; y < img.rows; y++) {
+    histogram_row(img.ptr<uint8_t>(y), static_cast<uint32_t>(img.cols), histogram);
+  }
+  return histogram;
+}
+
+WaveMode select_waveform(const GrayHistogram& next, const GrayHistogram& previous) {
+  const auto total                = std::accumulate(next.begin(), next.end(), uint64_t{0});
+  const auto black_white          = next.front() + next.back();
+  const auto previous_total       = std::accumulate(previous.begin(), previous.end(), uint64_t{0});
+  const bool previous_black_white = previous.front() + previous.back() == previous_total;
+  if (black_white == total) {
+    // A2 leaves ghosts when it starts from gray, DU doesn't
+    return previous_black_white ? WaveMode::A2 : WaveMode::DU;
+  }
+  if (static_cast<double>(black_white) >= text_like_ratio * static_cast<double>(total)) {
+    return WaveMode::GL16;
+  }
+  return WaveMode::GC16;
+}
+
+WaveMode select_waveform(const cv::Mat& next, const cv::Mat& previous) {
+  return select_waveform(gray_histogram(next), gray_histogram(previous));
+}
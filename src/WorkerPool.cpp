@@ -0,0 +1,59 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+#include "WorkerPool.hpp"
+#include <algorithm>
+#include <cassert>
+
+WorkerPool::WorkerPool(unsigned threads) {
+  workers.reserve(threads);
+  for (unsigned i = 0; i < threads; i++) workers.emplace_back(&WorkerPool::run_worker, this, i);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  work_changed.notify_all();
+  for (auto& worker : workers) worker.join();
+}
+
+void WorkerPool::run(unsigned count, Call task, void* task_context) {
+  assert(count <= size() + 1);
+  count = std::min(count, size() + 1);
+  if (count > 1) {
+    {
+      std::lock_guard lock(mutex);
+      call    = task;
+      context = task_context;
+      active  = count - 1;
+      pending = count - 1;
+      generation++;
+    }
+    work_changed.notify_all();
+  }
+  if (count > 0) task(task_context, 0);
+  if (count > 1) {
+    std::unique_lock lock(mutex);
+    work_done.wait(lock, [&] { return pending == 0; });
+  }
+}
+
+void WorkerPool::run_worker(unsigned index) {
+  uint64_t         seen = 0;
+  std::unique_lock lock(mutex);
+  while (true) {
+    work_changed.wait(lock, [&] { return stopping || generation != seen; });
+    if (stopping) return;
+    seen = generation;
+    if (index >= active) continue;
+    const auto task         = call;
+    auto*      task_context = context;
+    lock.unlock();
+    task(task_context, index + 1);
+    lock.lock();
+    if (--pending == 0) work_done.notify_one();
+  }
+}
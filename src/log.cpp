@@ -3,7 +3,14 @@
  * SPDX-License-Identifier: Apache-2.0
 */
 #include "log.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 #ifdef WIN32
 #include <Windows.h>
@@ -26,6 +33,216 @@ std::string format_last_error(DWORD lastError) {
 
 volatile LogLevel maxLogLevel = LogLevel::Warning;
 
+namespace {
+using log_detail::Record;
+
+// Records a full ring can hold, a power of two
+constexpr size_t queue_capacity = 1024;
+
+std::atomic<bool>              async_enabled{true};
+std::atomic<LogOverflowPolicy> overflow_policy{LogOverflowPolicy::Drop};
+std::atomic<uint64_t>          dropped{0};
+// Set at exit, later messages are written synchronously
+std::atomic<bool> shut_down{false};
+
+void append_line(const Record& record, fmt::memory_buffer& message, fmt::memory_buffer& out) {
+  message.clear();
+  if (record.format) {
+    record.format(record, message);
+  } else {
+    const auto* text = reinterpret_cast<const char*>(record.payload);
+    message.append(text, text + record.length);
+    if (record.truncated) message.append(std::string_view("..."));
+  }
+  fmt::format_to(std::back_inserter(out), log_color(record.level), "[{}] {:%T} | {}\n", log_char(record.level),
+                 record.time.time_since_epoch(), std::string_view(message.data(), message.size()));
+}
+
+void write_out(const fmt::memory_buffer& out) {
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fflush(stdout);
+  std::cout << std::flush;
+}
+
+/**
+ * Bounded multi-producer ring after Vyukov: a slot's sequence says whether it's free for
+ * the producer at that position or ready for the consumer. The single writer thread
+ * only sleeps after announcing it, so producers skip the wake-up while it's busy.
+ */
+class AsyncLogger {
+  // The record comes first, so a Record* handed out is also its Slot*
+  struct Slot {
+    Record              record;
+    std::atomic<size_t> sequence;
+  };
+  static_assert(std::is_standard_layout_v<Slot>);
+
+  std::unique_ptr<Slot[]> slots = std::make_unique<Slot[]>(queue_capacity);
+  alignas(64) std::atomic<size_t> enqueue_position{0};
+  alignas(64) std::atomic<uint64_t> written{0};  // Also the dequeue position, only the writer advances it
+  std::atomic<bool>     writer_sleeping{false};
+  std::atomic<uint64_t> wakeups{0};
+  std::thread           writer;
+
+  Slot* try_claim() {
+    auto position = enqueue_position.load(std::memory_order_relaxed);
+    while (true) {
+      auto&      slot     = slots[position % queue_capacity];
+      const auto sequence = slot.sequence.load(std::memory_order_acquire);
+      const auto diff     = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (diff == 0) {
+        if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) return &slot;
+      } else if (diff < 0) {
+        return nullptr;
+      } else {
+        position = enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void wake() {
+    wakeups.fetch_add(1, std::memory_order_seq_cst);
+    wakeups.notify_one();
+  }
+
+  void run() {
+    fmt::memory_buffer message;
+    fmt::memory_buffer out;
+    auto               position = written.load(std::memory_order_relaxed);
+    while (true) {
+      const auto seen = wakeups.load(std::memory_order_seq_cst);
+      out.clear();
+      size_t batch = 0;
+      while (true) {
+        auto& slot = slots[position % queue_capacity];
+        if (slot.sequence.load(std::memory_order_seq_cst) != position + 1) break;
+        try {
+          append_line(slot.record, message, out);
+        } catch (const fmt::format_error& e) {
+          fmt::format_to(std::back_inserter(out), "[E] couldn't format log message: {}\n", e.what());
+        }
+        slot.sequence.store(position + queue_capacity, std::memory_order_release);
+        position++;
+        // Free the slots every now and then so blocked producers don't wait for the whole ring
+        if (++batch % 64 == 0) {
+          written.store(position, std::memory_order_release);
+          written.notify_all();
+        }
+      }
+      if (out.size() != 0) write_out(out);
+      written.store(position, std::memory_order_release);
+      written.notify_all();
+
+      writer_sleeping.store(true, std::memory_order_seq_cst);
+      if (slots[position % queue_capacity].sequence.load(std::memory_order_seq_cst) != position + 1) {
+        wakeups.wait(seen, std::memory_order_seq_cst);
+      }
+      writer_sleeping.store(false, std::memory_order_relaxed);
+    }
+  }
+
+ public:
+  AsyncLogger() {
+    for (size_t i = 0; i < queue_capacity; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+    writer = std::thread([this] { run(); });
+  }
+  AsyncLogger(const AsyncLogger&)            = delete;
+  AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+  // Never destroyed, see async_logger
+  ~AsyncLogger() = delete;
+
+  Record* claim() {
+    while (true) {
+      const auto freed = written.load(std::memory_order_acquire);
+      if (auto* slot = try_claim()) return &slot->record;
+      if (overflow_policy.load(std::memory_order_relaxed) == LogOverflowPolicy::Drop) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      written.wait(freed, std::memory_order_acquire);
+    }
+  }
+
+  void publish(Record* record) {
+    auto*      slot     = reinterpret_cast<Slot*>(record);
+    const auto position = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(position + 1, std::memory_order_seq_cst);
+    if (writer_sleeping.load(std::memory_order_seq_cst)) wake();
+  }
+
+  void flush() {
+    const auto target = enqueue_position.load(std::memory_order_acquire);
+    for (auto done = written.load(std::memory_order_acquire); done < target;
+         done      = written.load(std::memory_order_acquire)) {
+      written.wait(done, std::memory_order_acquire);
+    }
+  }
+};
+
+// Leaked, threads still running during static destruction, e.g. a DisplayWorker's, may log at
+// any point. What's queued at exit is written out before later messages go out synchronously.
+AsyncLogger& async_logger() {
+  static auto& logger = []() -> AsyncLogger& {
+    auto* created = new AsyncLogger;
+    std::atexit([] {
+      shut_down.store(true);
+      async_logger().flush();
+    });
+    return *created;
+  }();
+  return logger;
+}
+
+bool use_async() { return async_enabled.load(std::memory_order_relaxed) && !shut_down.load(std::memory_order_relaxed); }
+
+// Synchronous messages are built here and written by publish right away
+thread_local Record scratch;
+}  // namespace
+
+namespace log_detail {
+Record* claim(LogLevel level) {
+  auto* record = use_async() ? async_logger().claim() : &scratch;
+  if (!record) return nullptr;
+  record->level     = level;
+  record->time      = std::chrono::system_clock::now();
+  record->format    = nullptr;
+  record->length    = 0;
+  record->truncated = false;
+  return record;
+}
+
+void publish(Record* record) {
+  if (record != &scratch) {
+    async_logger().publish(record);
+    return;
+  }
+  fmt::memory_buffer message;
+  fmt::memory_buffer out;
+  append_line(*record, message, out);
+  write_out(out);
+}
+
+void set_text(Record* record, std::string_view text) {
+  record->length    = static_cast<uint32_t>(std::min(text.size(), payload_size));
+  record->truncated = text.size() > payload_size;
+  std::memcpy(record->payload, text.data(), record->length);
+}
+}  // namespace log_detail
+
+void set_async_logging(bool enabled) {
+  if (!enabled) flush_log();
+  async_enabled.store(enabled);
+}
+
+void set_log_overflow_policy(LogOverflowPolicy policy) { overflow_policy.store(policy); }
+
+uint64_t dropped_log_messages() { return dropped.load(std::memory_order_relaxed); }
+
+void flush_log() {
+  if (use_async()) async_logger().flush();
+}
+
 fmt::text_style log_color(const LogLevel& lvl) {
   switch (lvl) {
     case LogLevel::Debug: return fmt::fg(fmt::terminal_color::magenta);
@@ -38,15 +255,10 @@ fmt::text_style log_color(const LogLevel& lvl) {
 
 void log(const LogLevel level, const std::string_view message) {
   if (!can_log(level)) return;
-//  if (level == LogLevel::Error){__builtin_trap();}
-  using namespace std::chrono;
-  //  const auto now = zoned_time(current_zone(), system_clock::now())
-  //                       .get_local_time()
-  //                       .time_since_epoch();
-  const auto now = system_clock::now().time_since_epoch();
-  fmt::print(log_color(level), "[{}] {:%T} | {}\n", log_char(level), now,
-             message);
-  std::cout << std::flush;
+  auto* record = log_detail::claim(level);
+  if (!record) return;
+  log_detail::set_text(record, message);
+  log_detail::publish(record);
 }
 bool can_log(const LogLevel& ll) {
   return ll >= maxLogLevel;
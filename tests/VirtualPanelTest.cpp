@@ -0,0 +1,177 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+// Runs the ScreenManager display paths end to end against a VirtualIT8951 and checks what
+// ends up on the emulated panel, what went over the link and how long the refreshes take.
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+#include "ScreenManager.hpp"
+#include "VirtualIT8951.hpp"
+#include "log.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t width  = 320;
+constexpr uint32_t height = 240;
+constexpr uint64_t pixels = static_cast<uint64_t>(width) * height;
+
+int failures = 0;
+
+void check(bool condition, const std::string& test, const std::string& what) {
+  if (condition) return;
+  fmt::print(stderr, "{}: {}\n", test, what);
+  failures++;
+}
+
+struct Panel {
+  std::shared_ptr<VirtualIT8951> device;
+  ScreenManager                  screen;
+};
+
+// A small panel with few waveform frames, so refreshes really take a while but tests stay fast
+Panel make_panel(const std::string& path) {
+  VirtualDeviceConfig config{.width = width, .height = height};
+  config.frame_counts = {6, 2, 4, 4, 4, 4, 2, 1};
+  // Room for both image buffers and two resident images
+  config.sdram_bytes = 4 * pixels;
+  auto device        = std::make_shared<VirtualIT8951>(config);
+  VirtualIT8951::register_device(path, device);
+  Panel panel{device, ScreenManager(IT8951{ScsiDriver(path.c_str())})};
+  // Unrotated, so panel coordinates are frame coordinates
+  panel.screen.set_rotation(-1);
+  return panel;
+}
+
+Mat make_frame(uint8_t seed) {
+  Mat frame(static_cast<int>(height), static_cast<int>(width), CV_8UC1);
+  for (int y = 0; y < frame.rows; y++) {
+    for (int x = 0; x < frame.cols; x++) frame.at<uint8_t>(y, x) = static_cast<uint8_t>(x + 3 * y + seed);
+  }
+  return frame;
+}
+
+bool shows(const Panel& panel, const Mat& frame) {
+  const auto image = panel.device->panel_image();
+  return image.size() == pixels && std::memcmp(image.data(), frame.data, pixels) == 0;
+}
+
+void display_shows_frame() {
+  const std::string test  = "display_shows_frame";
+  auto              panel = make_panel("/dev/sg-virtual-display");
+  const auto        frame = make_frame(0);
+  const auto        stats = panel.screen.display(frame);
+  check(stats.regions == 1, test, fmt::format("{} regions for the first frame", stats.regions));
+  check(stats.bytes_sent == pixels, test, fmt::format("{} bytes sent for {} pixels", stats.bytes_sent, pixels));
+  check(shows(panel, frame), test, "panel doesn't show the frame");
+  const auto device_stats = panel.device->stats();
+  // A fresh screen counts as cleared, which is displayed twice
+  check(device_stats.displays == 2, test, fmt::format("{} display commands", device_stats.displays));
+  check(device_stats.failed == 0, test, fmt::format("{} commands failed", device_stats.failed));
+  panel.screen.wait_until_ready();
+}
+
+void refresh_timing() {
+  const std::string test  = "refresh_timing";
+  auto              panel = make_panel("/dev/sg-virtual-timing");
+  const auto        start = Clock::now();
+  panel.screen.display(make_frame(0));
+  // GC16 takes 4 frames of the default frame time
+  const auto config  = panel.device->get_config();
+  const auto refresh = std::chrono::duration<double, std::milli>(4 * config.frame_time_ms);
+  check(panel.device->busy(), test, "device isn't refreshing after display");
+  check(panel.screen.predicted_ready() > Clock::now(), test, "ready predicted before the refresh ends");
+  check(panel.screen.predicted_ready() >= start + std::chrono::duration_cast<Clock::duration>(refresh), test,
+        "ready predicted sooner than the waveform takes");
+  check(panel.device->stats().refresh_busy >= refresh, test, "modelled refresh shorter than its frames");
+  check(panel.device->stats().link_busy > std::chrono::nanoseconds(0), test, "no modelled link time");
+  check(panel.screen.wait_until_ready(), test, "waiting for the refresh failed");
+  check(!panel.device->busy(), test, "device still refreshing after waiting for it");
+}
+
+void dirty_tiles() {
+  const std::string test  = "dirty_tiles";
+  auto              panel = make_panel("/dev/sg-virtual-dirty");
+  auto              frame = make_frame(0);
+  panel.screen.display(frame);
+  panel.screen.wait_until_ready();
+
+  auto stats = panel.screen.display(frame);
+  check(stats.regions == 0, test, fmt::format("{} regions for an unchanged frame", stats.regions));
+  check(stats.bytes_sent == 0, test, fmt::format("{} bytes sent for an unchanged frame", stats.bytes_sent));
+  check(stats.bytes_skipped == pixels, test, fmt::format("{} bytes skipped", stats.bytes_skipped));
+
+  frame(Rect(100, 50, 10, 10)).setTo(Scalar(0));
+  stats = panel.screen.display(frame);
+  check(stats.regions == 1, test, fmt::format("{} regions for one changed patch", stats.regions));
+  check(stats.bytes_sent > 0 && stats.bytes_sent < pixels / 4, test,
+        fmt::format("{} bytes sent for a 10x10 patch", stats.bytes_sent));
+  check(shows(panel, frame), test, "panel doesn't show the changed patch");
+  panel.screen.wait_until_ready();
+}
+
+void scheduled_regions() {
+  const std::string test  = "scheduled_regions";
+  auto              panel = make_panel("/dev/sg-virtual-scheduler");
+  auto              frame = make_frame(0);
+  panel.screen.display(frame);
+
+  // The controller is still refreshing, so both regions wait and get merged
+  const Mat first(16, 16, CV_8UC1, Scalar(0)), second(16, 16, CV_8UC1, Scalar(0xFF));
+  const auto stats = panel.screen.update_region(first, 0, 0);
+  check(stats.regions == 0, test, "region sent while the controller was busy");
+  panel.screen.update_region(second, 20, 0);
+  frame(Rect(0, 0, 16, 16)).setTo(Scalar(0));
+  frame(Rect(20, 0, 16, 16)).setTo(Scalar(0xFF));
+
+  const auto due = panel.screen.next_flush_due();
+  check(due.has_value(), test, "nothing due with regions queued");
+  if (!due) return;
+  check(*due <= Clock::now() + std::chrono::milliseconds(100), test, "due later than the latency budget");
+  check(!shows(panel, frame), test, "regions shown before they were due");
+  std::this_thread::sleep_until(*due);
+  const auto flushed = panel.screen.flush_if_due();
+  check(flushed.regions == 1, test, fmt::format("{} regions flushed for two nearby updates", flushed.regions));
+  check(!panel.screen.next_flush_due(), test, "regions still queued after flushing");
+  check(shows(panel, frame), test, "panel doesn't show the flushed regions");
+  panel.screen.wait_until_ready();
+}
+
+void resident_images() {
+  const std::string test  = "resident_images";
+  auto              panel = make_panel("/dev/sg-virtual-resident");
+  check(!panel.screen.set_resident_image_slots(2), test, "slots kept without a confirmed buffer layout");
+  panel.screen.set_image_buffer_layout_confirmed(true);
+  check(panel.screen.set_resident_image_slots(2), test, "slots refused with a confirmed buffer layout");
+
+  const auto first = make_frame(0), second = make_frame(128);
+  panel.screen.display(first);
+  panel.screen.display(second);
+  const auto loads = panel.device->stats().loads;
+  const auto stats = panel.screen.display(first);
+  check(stats.bytes_sent == 0, test, fmt::format("{} bytes sent for a resident image", stats.bytes_sent));
+  check(stats.bytes_skipped == pixels, test, fmt::format("{} bytes skipped", stats.bytes_skipped));
+  check(panel.device->stats().loads == loads, test, "resident image was loaded again");
+  check(panel.screen.resident_image_stats().hits == 1, test,
+        fmt::format("{} resident hits", panel.screen.resident_image_stats().hits));
+  check(shows(panel, first), test, "panel doesn't show the resident image");
+  panel.screen.wait_until_ready();
+}
+}  // namespace
+
+int main() {
+  maxLogLevel = LogLevel::Warning;
+  display_shows_frame();
+  refresh_timing();
+  dirty_tiles();
+  scheduled_regions();
+  resident_images();
+  if (failures > 0) fmt::print(stderr, "{} checks failed\n", failures);
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2023 Robert Bezem (robert@sqrtroot.com)
+ * SPDX-License-Identifier: Apache-2.0
+*/
+// Renders images for a panel ahead of time and stores them as panel images, which
+// ScreenManager::display maps and uploads without decoding anything.
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+#include <opencv2/imgcodecs.hpp>
+#include "Dither.hpp"
+#include "ImagePipeline.hpp"
+#include "PanelImage.hpp"
+#include "log.hpp"
+
+namespace {
+struct Options {
+  uint32_t    width    = 0;
+  uint32_t    height   = 0;
+  int         rotation = 1;  // ScreenManager's default
+  PixelFormat format   = PixelFormat::Bpp8;
+  DitherMode  dither   = DitherMode::None;
+  WaveMode    wavemode = WaveMode::GC16;
+  // Convert even when the output is newer than its input
+  bool force = false;
+  std::vector<std::filesystem::path> inputs;
+  std::filesystem::path              output;
+};
+
+template <typename T>
+bool parse_name(std::string_view value, const std::vector<std::pair<std::string_view, T>>& names, T& result) {
+  for (const auto& [name, option] : names) {
+    if (value == name) {
+      result = option;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parse_option(std::string_view argument, Options& options) {
+  const auto separator = argument.find('=');
+  if (separator == std::string_view::npos) return false;
+  const auto key          = argument.substr(0, separator);
+  const auto value        = argument.substr(separator + 1);
+  const auto value_string = std::string(value);
+  if (key == "--width") {
+    options.width = static_cast<uint32_t>(std::atoi(value_string.c_str()));
+    return options.width > 0;
+  }
+  if (key == "--height") {
+    options.height = static_cast<uint32_t>(std::atoi(value_string.c_str()));
+    return options.height > 0;
+  }
+  if (key == "--rotation") {
+    options.rotation = std::atoi(value_string.c_str());
+    return options.rotation >= -1 && options.rotation <= 2;
+  }
+  if (key == "--format") {
+    return parse_name<PixelFormat>(
+        value, {{"1", PixelFormat::Bpp1}, {"2", PixelFormat::Bpp2}, {"4", PixelFormat::Bpp4}, {"8", PixelFormat::Bpp8}},
+        options.format);
+  }
+  if (key == "--dither") {
+    return parse_name<DitherMode>(value,
+                                  {{"none", DitherMode::None},
+                                   {"bayer", DitherMode::Bayer},
+                                   {"blue-noise", DitherMode::BlueNoise},
+                                   {"floyd-steinberg", DitherMode::FloydSteinberg},
+                                   {"atkinson", DitherMode::Atkinson}},
+                                  options.dither);
+  }
+  if (key == "--wavemode") {
+    return parse_name<WaveMode>(value,
+                                {{"du", WaveMode::DU},
+                                 {"gc16", WaveMode::GC16},
+                                 {"gl16", WaveMode::GL16},
+                                 {"glr16", WaveMode::GLR16},
+                                 {"gld16", WaveMode::GLD16},
+                                 {"du4", WaveMode::DU4},
+                                 {"a2", WaveMode::A2}},
+                                options.wavemode);
+  }
+  return false;
+}
+
+bool is_image(const std::filesystem::path& path) {
+  constexpr std::array<std::string_view, 9> extensions{".png",  ".jpg", ".jpeg", ".bmp", ".gif",
+                                                       ".tif",  ".tiff", ".webp", ".pgm"};
+  auto extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+// Pairs every input image with its output, directories keep their layout below output
+std::vector<std::pair<std::filesystem::path, std::filesystem::path>> collect(const Options& options) {
+  std::vector<std::pair<std::filesystem::path, std::filesystem::path>> files;
+  for (const auto& input : options.inputs) {
+    if (!std::filesystem::is_directory(input)) {
+      files.emplace_back(input, options.output / input.filename().replace_extension(panel_image_extension));
+      continue;
+    }
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(input)) {
+      if (!entry.is_regular_file() || !is_image(entry.path())) continue;
+      auto relative = std::filesystem::relative(entry.path(), input);
+      files.emplace_back(entry.path(), options.output / relative.replace_extension(panel_image_extension));
+    }
+  }
+  return files;
+}
+
+bool up_to_date(const std::filesystem::path& input, const std::filesystem::path& output) {
+  std::error_code output_error, input_error;
+  const auto      output_time = std::filesystem::last_write_time(output, output_error);
+  const auto      input_time  = std::filesystem::last_write_time(input, input_error);
+  return !output_error && !input_error && output_time >= input_time;
+}
+
+bool convert(const Options& options, const std::filesystem::path& input, const std::filesystem::path& output,
+             std::vector<uint8_t>& frame_buffer) {
+  const auto image = cv::imread(input.string(), cv::IMREAD_GRAYSCALE);
+  if (image.empty()) {
+    log(LogLevel::Error, "Couldn't load image {}", input.string());
+    return false;
+  }
+  frame_buffer.resize(static_cast<size_t>(options.width) * options.height);
+  // Same steps as ScreenManager::render_to_display, dithering needs the full 8 bit values
+  const auto format = options.dither == DitherMode::None ? options.format : PixelFormat::Bpp8;
+  render_to_panel(image, options.rotation, options.width, options.height, quantization_table(format),
+                  frame_buffer);
+  cv::Mat frame(static_cast<int>(options.height), static_cast<int>(options.width), CV_8UC1, frame_buffer.data());
+  dither(frame, options.format, options.dither);
+
+  std::error_code error;
+  std::filesystem::create_directories(output.parent_path(), error);
+  return write_panel_image(output, frame, options.format, options.rotation, options.wavemode);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options                            options;
+  std::vector<std::filesystem::path> paths;
+  bool                               valid = true;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view argument = argv[i];
+    if (argument == "--force") {
+      options.force = true;
+    } else if (argument.starts_with("--")) {
+      valid &= parse_option(argument, options);
+    } else {
+      paths.emplace_back(argv[i]);
+    }
+  }
+  if (!valid || options.width == 0 || options.height == 0 || paths.size() < 2) {
+    fmt::print(stderr,
+               "Usage: {} --width=N --height=N [--rotation=-1|0|1|2] [--format=1|2|4|8]\n"
+               "       [--dither=none|bayer|blue-noise|floyd-steinberg|atkinson]\n"
+               "       [--wavemode=du|gc16|gl16|glr16|gld16|du4|a2] [--force] <input>... <output directory>\n",
+               argv[0]);
+    return 1;
+  }
+  options.output = paths.back();
+  paths.pop_back();
+  options.inputs = std::move(paths);
+  maxLogLevel    = LogLevel::Warning;
+
+  size_t               converted = 0, skipped = 0, failed = 0;
+  std::vector<uint8_t> frame_buffer;
+  for (const auto& [input, output] : collect(options)) {
+    if (!options.force && up_to_date(input, output)) {
+      skipped++;
+    } else if (convert(options, input, output, frame_buffer)) {
+      converted++;
+    } else {
+      failed++;
+    }
+  }
+  fmt::print("Converted {}, up to date {}, failed {}\n", converted, skipped, failed);
+  return failed == 0 ? 0 : 1;
+}